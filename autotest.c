@@ -0,0 +1,77 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Recognizing the rosautotest output
+ */
+
+#include "sysreg.h"
+
+/* rosautotest announces each test with:
+ *   Running Wine Test, Module: kernel32, Test: file
+ * Name receives "kernel32:file" then.
+ */
+bool GetTestName(const char* Line, char* Name, size_t Size)
+{
+    const char* Module;
+    const char* Test;
+    size_t ModuleLength;
+    size_t TestLength;
+
+    Module = strstr(Line, "Running Wine Test, Module: ");
+    if (!Module)
+        return false;
+
+    Module += sizeof("Running Wine Test, Module: ") - 1;
+    Test = strstr(Module, ", Test: ");
+    if (!Test)
+        return false;
+
+    ModuleLength = Test - Module;
+    Test += sizeof(", Test: ") - 1;
+    TestLength = strcspn(Test, "\r\n");
+
+    if (ModuleLength + TestLength + 2 > Size)
+        return false;
+
+    memcpy(Name, Module, ModuleLength);
+    Name[ModuleLength] = ':';
+    memcpy(Name + ModuleLength + 1, Test, TestLength);
+    Name[ModuleLength + TestLength + 1] = 0;
+
+    return true;
+}
+
+/* Wine tests end with a summary line, like:
+ *   0d94:file: 1234 tests executed (0 marked as todo, 3 failures), 2 skipped.
+ * or with "0 as flaky" as well in newer versions.
+ */
+bool GetTestResult(const char* Line, unsigned int* Executed, unsigned int* Failures)
+{
+    const char* Summary;
+    const char* Count;
+    const char* End;
+
+    Summary = strstr(Line, " tests executed (");
+    if (!Summary)
+        return false;
+
+    /* The number right before it */
+    for (Count = Summary; Count > Line && Count[-1] >= '0' && Count[-1] <= '9'; Count--)
+        ;
+    if (Count == Summary)
+        return false;
+
+    End = strstr(Summary, " failure");
+    if (!End)
+        return false;
+
+    /* Same for the failures */
+    for (Summary = End; Summary > Line && Summary[-1] >= '0' && Summary[-1] <= '9'; Summary--)
+        ;
+    if (Summary == End)
+        return false;
+
+    *Executed = (unsigned int)strtoul(Count, NULL, 10);
+    *Failures = (unsigned int)strtoul(Summary, NULL, 10);
+    return true;
+}
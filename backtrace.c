@@ -0,0 +1,207 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Backtrace of a hung guest taken from the host, through the monitor of the emulator
+ */
+
+#include "sysreg.h"
+
+#define MAX_MODULES         512
+
+/* A guest hanging with interrupts off never gets to KDBG on TAB+K. Its
+ * registers and stack are then read through the monitor of the emulator,
+ * following the frame pointers from EBP, on the first CPU, which is
+ * stopped meanwhile so that they all come from one instant. Addresses are
+ * mapped onto the modules of the last KDBG "mod" listing seen on the serial
+ * port, and resolved like the backtraces KDBG prints itself.
+ */
+
+typedef struct _LoadedModule
+{
+    char Name[64];
+    unsigned long long Base;
+    unsigned long long Size;
+}
+LoadedModule;
+
+static LoadedModule Modules[MAX_MODULES];
+static unsigned int ModuleCount;
+
+/* "  80400000  0021c000  ntoskrnl.exe", a line of the "mod" listing */
+void BacktraceModuleLine(const char* Line)
+{
+    unsigned long long Base, Size;
+    char Name[64];
+    const char* Extension;
+    unsigned int i;
+
+    while (*Line == ' ')
+        ++Line;
+
+    /* Every line goes through here, most fail this already */
+    if (strspn(Line, "0123456789abcdefABCDEF") < 8)
+        return;
+
+    if (sscanf(Line, "%llx %llx %63s", &Base, &Size, Name) != 3 || Size == 0)
+        return;
+
+    Extension = strrchr(Name, '.');
+    if (!Extension || (strcasecmp(Extension, ".exe") && strcasecmp(Extension, ".dll") && strcasecmp(Extension, ".sys")))
+        return;
+
+    /* A later listing is the one of the current boot */
+    for (i = 0; i < ModuleCount && strcasecmp(Modules[i].Name, Name); i++)
+        ;
+
+    if (i == MAX_MODULES)
+        return;
+    if (i == ModuleCount)
+        ++ModuleCount;
+
+    strcpy(Modules[i].Name, Name);
+    Modules[i].Base = Base;
+    Modules[i].Size = Size;
+}
+
+/* Value of a register in the output of "info registers" */
+static bool GetRegister(const char* Registers, const char* Name, unsigned long long* Value)
+{
+    char Pattern[8];
+    const char* p;
+
+    snprintf(Pattern, sizeof(Pattern), "%s=", Name);
+    p = strstr(Registers, Pattern);
+    if (!p)
+        return false;
+
+    *Value = strtoull(p + strlen(Pattern), NULL, 16);
+    return true;
+}
+
+/* Two words of guest memory at Address, through the page tables of the CPU */
+static bool ReadWords(unsigned long long Address, bool Long, unsigned long long* First, unsigned long long* Second)
+{
+    char Command[64];
+    char Result[256];
+    const char* p;
+    char* End;
+
+    snprintf(Command, sizeof(Command), "x /2%cx 0x%llx", (Long ? 'g' : 'w'), Address);
+    if (!MachineMonitorCommand(Command, Result, sizeof(Result)))
+        return false;
+
+    /* "00000000f7a1c000: 0x12345678 0x9abcdef0" */
+    p = strchr(Result, ':');
+    if (!p)
+        return false;
+
+    *First = strtoull(p + 1, &End, 16);
+    if (End == p + 1)
+        return false;
+
+    p = End;
+    *Second = strtoull(p, &End, 16);
+    return (End != p);
+}
+
+static void PrintFrame(int Stage, unsigned int Frame, unsigned long long Address)
+{
+    char Line[160];
+    char Resolved[512];
+    char Output[540];
+    unsigned int i;
+
+    for (i = 0; i < ModuleCount; i++)
+    {
+        if (Address >= Modules[i].Base && Address - Modules[i].Base < Modules[i].Size)
+            break;
+    }
+
+    /* The same as a frame of KDBG, so that it gets resolved the same way */
+    if (i < ModuleCount)
+        snprintf(Line, sizeof(Line), "<%s:%llx>\n", Modules[i].Name, Address - Modules[i].Base);
+    else
+        snprintf(Line, sizeof(Line), "<%llx>\n", Address);
+
+    if (!ResolveAddressFromFile(Resolved, sizeof(Resolved), Line))
+        strcpy(Resolved, Line);
+
+    snprintf(Output, sizeof(Output), "Frame #%u: %s", Frame, Resolved);
+    printf("%s", Output);
+    SerialLogLine(Stage, Output, true);
+}
+
+static bool WalkStack(int Stage, bool Consistent)
+{
+    char Registers[4096];
+    char Header[200];
+    unsigned long long Pc, Stack, Frame, Next, Return;
+    unsigned int i;
+    bool Long;
+
+    if (!MachineMonitorCommand("info registers", Registers, sizeof(Registers)))
+        return false;
+
+    /* A 64-bit CPU in long mode tells RIP, otherwise EIP */
+    Long = GetRegister(Registers, "RIP", &Pc);
+    if ((!Long && !GetRegister(Registers, "EIP", &Pc)) ||
+        !GetRegister(Registers, (Long ? "RSP" : "ESP"), &Stack) ||
+        !GetRegister(Registers, (Long ? "RBP" : "EBP"), &Frame))
+    {
+        SysregPrintf("No registers in the monitor answer\n");
+        return false;
+    }
+
+    snprintf(Header, sizeof(Header), "Host backtrace of CPU 0%s: %s=%llx %s=%llx %s=%llx, %u modules known\n",
+             (Consistent ? "" : " (guest running, not a consistent snapshot)"),
+             (Long ? "RIP" : "EIP"), Pc, (Long ? "RSP" : "ESP"), Stack, (Long ? "RBP" : "EBP"), Frame, ModuleCount);
+    SysregPrintf("%s", Header);
+    SerialLogLine(Stage, Header, true);
+
+    PrintFrame(Stage, 0, Pc);
+
+    /* Each frame starts with the frame pointer of its caller, followed by the return address.
+       The caller's frame is further up the stack, anything else ends the walk */
+    for (i = 1; i < AppSettings.BacktraceFrames; i++)
+    {
+        if (Frame == 0 || (Frame & (Long ? 7 : 3)) || Frame < Stack)
+            break;
+
+        if (!ReadWords(Frame, Long, &Next, &Return) || Return == 0)
+            break;
+
+        PrintFrame(Stage, i, Return);
+
+        if (Next <= Frame)
+            break;
+
+        Frame = Next;
+    }
+
+    return true;
+}
+
+bool HostBacktrace(int Stage)
+{
+    char Status[256];
+    bool Paused = false, Stopped = false;
+    bool Ret;
+
+    if (AppSettings.BacktraceFrames == 0)
+        return false;
+
+    /* A spinning vCPU moves on between the reads, the registers and the frames
+       only fit together while it is stopped. One that was paused already stays so */
+    if (MachineMonitorCommand("info status", Status, sizeof(Status)))
+    {
+        Paused = (strstr(Status, "paused") != NULL);
+        Stopped = (!Paused && strstr(Status, "running") && MachineMonitorCommand("stop", Status, sizeof(Status)));
+    }
+
+    Ret = WalkStack(Stage, (Paused || Stopped));
+
+    if (Stopped && !MachineMonitorCommand("cont", Status, sizeof(Status)))
+        SysregPrintf("Cannot resume the guest after the backtrace\n");
+
+    return Ret;
+}
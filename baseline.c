@@ -0,0 +1,197 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Comparing the rosautotest results with a baseline while they come in
+ */
+
+#include "sysreg.h"
+
+/* Results files have one line per test:
+ *   <test> <executed> <failures>
+ * The results of a run are written in the same format, so the results of
+ * a good run can be the baseline of the next ones.
+ */
+
+typedef struct _TestResult
+{
+    char Name[128];
+    bool InBaseline;
+    unsigned int BaseFailures;
+    bool Ran;
+    unsigned int Executed;
+    unsigned int Failures;
+}
+TestResult;
+
+static TestResult* Results;
+static unsigned int ResultCount;
+static unsigned int ResultSize;
+static unsigned int NewFailures;
+static bool HaveBaseline;
+
+static TestResult* FindResult(const char* Name, bool Create)
+{
+    unsigned int i;
+
+    for (i = 0; i < ResultCount; i++)
+    {
+        if (!strcmp(Results[i].Name, Name))
+            return &Results[i];
+    }
+
+    if (!Create)
+        return NULL;
+
+    if (ResultCount == ResultSize)
+    {
+        TestResult* Grown;
+
+        ResultSize = (ResultSize ? ResultSize * 2 : 256);
+        Grown = (TestResult*)realloc(Results, ResultSize * sizeof(TestResult));
+        if (!Grown)
+            return NULL;
+
+        Results = Grown;
+    }
+
+    memset(&Results[ResultCount], 0, sizeof(TestResult));
+    strncpy(Results[ResultCount].Name, Name, sizeof(Results[ResultCount].Name) - 1);
+    return &Results[ResultCount++];
+}
+
+/* Failures of a test beyond those of the baseline */
+static unsigned int Regression(const TestResult* Result)
+{
+    unsigned int Base = (Result->InBaseline ? Result->BaseFailures : 0);
+
+    return (Result->Failures > Base ? Result->Failures - Base : 0);
+}
+
+bool LoadBaseline(void)
+{
+    FILE* File;
+    char Line[256];
+    char Name[128];
+    unsigned int Executed, Failures;
+
+    ResultCount = 0;
+    NewFailures = 0;
+    HaveBaseline = false;
+
+    if (!AppSettings.BaselineFile[0])
+        return true;
+
+    File = fopen(AppSettings.BaselineFile, "r");
+    if (!File)
+        return false;
+
+    while (fgets(Line, sizeof(Line), File))
+    {
+        TestResult* Result;
+
+        if (sscanf(Line, "%127s %u %u", Name, &Executed, &Failures) != 3)
+            continue;
+
+        Result = FindResult(Name, true);
+        if (!Result)
+            break;
+
+        Result->InBaseline = true;
+        Result->BaseFailures = Failures;
+    }
+
+    fclose(File);
+    HaveBaseline = true;
+    return true;
+}
+
+/* One summary line of Test. True once the run regressed beyond the failure budget */
+bool BaselineResult(const char* Test, unsigned int Executed, unsigned int Failures)
+{
+    TestResult* Result;
+    unsigned int Before;
+
+    if (!HaveBaseline && !AppSettings.ResultsFile[0])
+        return false;
+
+    Result = FindResult(Test, true);
+    if (!Result)
+        return false;
+
+    /* Tests running child processes print a summary line for each */
+    Before = Regression(Result);
+    Result->Ran = true;
+    Result->Executed += Executed;
+    Result->Failures += Failures;
+
+    if (!HaveBaseline || Regression(Result) == Before)
+        return false;
+
+    NewFailures += Regression(Result) - Before;
+
+    if (Result->InBaseline)
+        SysregPrintf("Regression in %s: %u failures, %u in the baseline\n", Test, Result->Failures, Result->BaseFailures);
+    else
+        SysregPrintf("Regression in %s: %u failures, not in the baseline\n", Test, Result->Failures);
+
+    return (AppSettings.FailureBudget >= 0 && NewFailures > (unsigned int)AppSettings.FailureBudget);
+}
+
+bool SaveResults(void)
+{
+    FILE* File;
+    char TempPath[260];
+    unsigned int Regressed = 0, Fixed = 0, NotRun = 0, i;
+
+    /* The diff against the baseline, as far as the run went */
+    if (HaveBaseline)
+    {
+        for (i = 0; i < ResultCount; i++)
+        {
+            if (!Results[i].Ran)
+                NotRun += Results[i].InBaseline;
+            else if (Regression(&Results[i]))
+                ++Regressed;
+            else if (Results[i].InBaseline && Results[i].Failures < Results[i].BaseFailures)
+                ++Fixed;
+        }
+
+        SysregPrintf("Baseline diff: %u tests regressed (%u new failures), %u improved, %u not run\n",
+                     Regressed, NewFailures, Fixed, NotRun);
+    }
+
+    if (!AppSettings.ResultsFile[0])
+        return true;
+
+    /* Same as the history, readers never see half a file */
+    snprintf(TempPath, sizeof(TempPath), "%s.tmp", AppSettings.ResultsFile);
+    File = fopen(TempPath, "w");
+    if (!File)
+    {
+        SysregPrintf("Failed opening %s: %d\n", TempPath, errno);
+        return false;
+    }
+
+    for (i = 0; i < ResultCount; i++)
+    {
+        if (Results[i].Ran)
+            fprintf(File, "%s %u %u\n", Results[i].Name, Results[i].Executed, Results[i].Failures);
+    }
+
+    if (fclose(File) != 0 || rename(TempPath, AppSettings.ResultsFile) < 0)
+    {
+        SysregPrintf("Failed writing results to %s: %d\n", AppSettings.ResultsFile, errno);
+        unlink(TempPath);
+        return false;
+    }
+
+    return true;
+}
+
+void FreeBaseline(void)
+{
+    free(Results);
+    Results = NULL;
+    ResultCount = 0;
+    ResultSize = 0;
+}
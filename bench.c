@@ -0,0 +1,413 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Serial flood throughput benchmark for ProcessDebugData, over a pty or a unix socket
+ */
+
+#include "sysreg.h"
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MB                  (1024.0 * 1024.0)
+
+const char gGitCommit[] = "bench";
+const char* OutputPath = "output-i386";
+Settings AppSettings;
+ModuleListEntry* ModuleList;
+
+typedef struct _Latency
+{
+    unsigned int Count;
+    double Min;
+    double Max;
+    double Total;
+}
+Latency;
+
+typedef struct _GeneratorStats
+{
+    unsigned long long Written;
+    double Elapsed;
+    double Behind;
+    Latency Backtrace;
+    Latency Cont;
+}
+GeneratorStats;
+
+/* No machine behind the console here */
+bool BreakToDebugger(void)
+{
+    return false;
+}
+
+int GetMachineEventFd(void)
+{
+    return -1;
+}
+
+int ReadMachineEvents(void)
+{
+    return 0;
+}
+
+int GetConsoleWriteFd(void)
+{
+    return -1;
+}
+
+bool GetMachineCpuTime(unsigned long long* CpuTime)
+{
+    (void)CpuTime;
+    return false;
+}
+
+bool MachineMonitorCommand(const char* Command, char* Result, size_t Size)
+{
+    (void)Command;
+    (void)Result;
+    (void)Size;
+    return false;
+}
+
+static double Now(void)
+{
+    return MetricsNow() / 1e9;
+}
+
+static void AddLatency(Latency* Lat, double Value)
+{
+    if (Lat->Count == 0 || Value < Lat->Min)
+        Lat->Min = Value;
+    if (Value > Lat->Max)
+        Lat->Max = Value;
+
+    Lat->Total += Value;
+    ++Lat->Count;
+}
+
+static bool WriteAll(int fd, const char* Data, size_t Length, GeneratorStats* Stats, double Start, double Rate)
+{
+    double Expected;
+    ssize_t r;
+
+    while (Length > 0)
+    {
+        r = write(fd, Data, Length);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return false;
+
+        Data += r;
+        Length -= r;
+        Stats->Written += r;
+    }
+
+    if (Rate <= 0)
+        return true;
+
+    /* Keep to the requested rate, and see whether the reader keeps up with it */
+    Expected = Start + Stats->Written / Rate;
+    if (Now() < Expected)
+        usleep((useconds_t)((Expected - Now()) * 1e6));
+    else if (Now() - Expected > Stats->Behind)
+        Stats->Behind = Now() - Expected;
+
+    return true;
+}
+
+static bool WaitFor(int fd, const char* Command, Latency* Lat)
+{
+    char Input[64];
+    size_t Length = 0;
+    double Start = Now();
+    ssize_t r;
+
+    while (Now() - Start < 5.0)
+    {
+        struct pollfd fds[] = {
+            { fd, POLLIN, 0 },
+        };
+
+        if (poll(fds, 1, 100) <= 0)
+            continue;
+
+        r = read(fd, Input + Length, sizeof(Input) - Length - 1);
+        if (r <= 0)
+            return false;
+
+        Length += r;
+        Input[Length] = 0;
+
+        if (strstr(Input, Command))
+        {
+            AddLatency(Lat, Now() - Start);
+            return true;
+        }
+
+        if (Length == sizeof(Input) - 1)
+            Length = 0;
+    }
+
+    return false;
+}
+
+/* Plays a ReactOS guest: debug output bursts, repeated lines and KDBG sessions */
+static void Generator(int fd, unsigned long long Size, double Rate, int StatsFd)
+{
+    GeneratorStats Stats;
+    char Line[256];
+    double Start;
+    unsigned int Block, i;
+    int Length;
+
+    memset(&Stats, 0, sizeof(Stats));
+    Start = Now();
+
+    for (Block = 0; Stats.Written < Size; Block++)
+    {
+        /* Long DPRINT burst, every line different */
+        for (i = 0; i < 200; i++)
+        {
+            Length = snprintf(Line, sizeof(Line),
+                              "(ntoskrnl/io/iomgr/driver.c:%u) IopLoadDriver(): loading module %u at 0x%08x, flags 0x%x\n",
+                              1000 + i, Block, 0x80400000 + Block * 0x1000 + i, i * 7);
+            if (!WriteAll(fd, Line, Length, &Stats, Start, Rate))
+                goto done;
+        }
+
+        /* The same line a few times, below the cache hits limit */
+        for (i = 0; i < 20; i++)
+        {
+            Length = snprintf(Line, sizeof(Line), "err:(win32ss/user/ntuser/msgqueue.c:%u) Message queue is full\n", Block);
+            if (!WriteAll(fd, Line, Length, &Stats, Start, Rate))
+                goto done;
+        }
+
+        /* Now and then, a trip to KDBG: bt first, then cont */
+        if (Block % 10 == 9)
+        {
+            static const char Prompt[] = "kdb:> ";
+
+            if (!WriteAll(fd, Prompt, sizeof(Prompt) - 1, &Stats, Start, 0) ||
+                !WaitFor(fd, "bt\r", &Stats.Backtrace))
+                goto done;
+
+            for (i = 0; i < 8; i++)
+            {
+                Length = snprintf(Line, sizeof(Line), "<ntoskrnl.exe:%x>\n", 0x1a2b3 + i * 0x40 + Block);
+                if (!WriteAll(fd, Line, Length, &Stats, Start, 0))
+                    goto done;
+            }
+
+            if (!WriteAll(fd, Prompt, sizeof(Prompt) - 1, &Stats, Start, 0) ||
+                !WaitFor(fd, "cont\r", &Stats.Cont))
+                goto done;
+        }
+    }
+
+done:
+    Stats.Elapsed = Now() - Start;
+    if (write(StatsFd, &Stats, sizeof(Stats)) != sizeof(Stats))
+        _exit(1);
+    _exit(0);
+}
+
+/* The guest side of the socket, connecting like QEMU does with a unix chardev */
+static int ConnectGuest(const char* Path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, Path, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void PrintLatency(const char* Name, const Latency* Lat)
+{
+    if (Lat->Count == 0)
+    {
+        fprintf(stderr, "%-24s no samples\n", Name);
+        return;
+    }
+
+    fprintf(stderr, "%-24s min %.3f ms, avg %.3f ms, max %.3f ms (%u samples)\n", Name,
+            Lat->Min * 1e3, Lat->Total / Lat->Count * 1e3, Lat->Max * 1e3, Lat->Count);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long Size = 16 * 1024 * 1024;
+    double Rate = 0;
+    GeneratorStats Stats;
+    struct rusage Usage;
+    struct termios Attr;
+    int StatsPipe[2];
+    int Master = -1, Slave, Listener = -1;
+    int opt, Ret;
+    bool Socket = false;
+    char SocketPath[64];
+    double Cpu;
+    pid_t Child;
+
+    while ((opt = getopt(argc, argv, "s:r:m:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                Size = strtoull(optarg, NULL, 10) * 1024 * 1024;
+                break;
+
+            case 'r':
+                Rate = strtod(optarg, NULL) * MB;
+                break;
+
+            case 'm':
+                Socket = !strcmp(optarg, "socket");
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-s MB to send] [-r MB/s, 0 for as fast as possible] [-m pty|socket]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    /* Same settings as a regular test run */
+    AppSettings.Timeout = 5000;
+    AppSettings.GlobalTimeout = time(0) + 3600;
+    AppSettings.MaxCacheHits = 50;
+    AppSettings.MaxConts = ~0U;
+
+    if (pipe(StatsPipe) < 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+
+    if (Socket)
+    {
+        /* Same socket the KVM serial="" mode listens on */
+        snprintf(SocketPath, sizeof(SocketPath), "/tmp/sysreg2-bench.%d", (int)getpid());
+        Listener = CreateLocalSocket(SocketPath);
+        if (Listener < 0)
+            return 1;
+    }
+    else
+    {
+        /* The guest gets the master side, like QEMU does */
+        Master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (Master < 0 || grantpt(Master) < 0 || unlockpt(Master) < 0)
+        {
+            perror("posix_openpt");
+            return 1;
+        }
+
+        Slave = open(ptsname(Master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (Slave < 0)
+        {
+            perror("open");
+            return 1;
+        }
+
+        tcgetattr(Slave, &Attr);
+        cfmakeraw(&Attr);
+        tcsetattr(Slave, TCSANOW, &Attr);
+        tcgetattr(Master, &Attr);
+        cfmakeraw(&Attr);
+        tcsetattr(Master, TCSANOW, &Attr);
+    }
+
+    InitializeModuleList();
+
+    Child = fork();
+    if (Child < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+
+    if (Child == 0)
+    {
+        if (Socket)
+        {
+            close(Listener);
+            Master = ConnectGuest(SocketPath);
+            if (Master < 0)
+                _exit(1);
+        }
+        else
+        {
+            close(Slave);
+        }
+
+        close(StatsPipe[0]);
+        Generator(Master, Size, Rate, StatsPipe[1]);
+    }
+
+    close(StatsPipe[1]);
+
+    if (Socket)
+    {
+        Slave = AcceptLocalSocket(Listener, 5000);
+        close(Listener);
+        unlink(SocketPath);
+        if (Slave < 0)
+        {
+            kill(Child, SIGKILL);
+            return 1;
+        }
+    }
+
+    /* Relayed output is not what we measure */
+    if (!freopen("/dev/null", "w", stdout))
+    {
+        perror("freopen");
+        return 1;
+    }
+
+    Ret = ProcessDebugData(Slave, AppSettings.Timeout, 0);
+
+    if (read(StatsPipe[0], &Stats, sizeof(Stats)) != sizeof(Stats))
+    {
+        fprintf(stderr, "Generator failed\n");
+        kill(Child, SIGKILL);
+        return 1;
+    }
+
+    if (Master >= 0)
+        close(Master);
+    close(Slave);
+    waitpid(Child, NULL, 0);
+
+    getrusage(RUSAGE_SELF, &Usage);
+    Cpu = Usage.ru_utime.tv_sec + Usage.ru_utime.tv_usec / 1e6 +
+          Usage.ru_stime.tv_sec + Usage.ru_stime.tv_usec / 1e6;
+
+    fprintf(stderr, "ProcessDebugData returned %d over a %s\n", Ret, (Socket ? "unix socket" : "pty"));
+    fprintf(stderr, "%-24s %.2f MB in %.3f s\n", "Sent", Stats.Written / MB, Stats.Elapsed);
+    fprintf(stderr, "%-24s %.2f MB/s\n", (Rate > 0 ? "Throughput" : "Max sustained"),
+            Stats.Written / MB / Stats.Elapsed);
+    if (Rate > 0)
+        fprintf(stderr, "%-24s %s (up to %.3f s behind %.2f MB/s)\n", "Backpressure",
+                (Stats.Behind > 0.1 ? "yes" : "no"), Stats.Behind, Rate / MB);
+    fprintf(stderr, "%-24s %.3f s per MB (%.3f s user+sys)\n", "CPU cost", Cpu / (Stats.Written / MB), Cpu);
+    PrintLatency("bt prompt latency", &Stats.Backtrace);
+    PrintLatency("cont prompt latency", &Stats.Cont);
+
+    CleanModuleList();
+    return 0;
+}
@@ -10,7 +10,10 @@
 #include "sysreg.h"
 #define BUFFER_SIZE         512
 
-int ProcessDebugData(const char* tty, int timeout, int stage )
+/* How long the output a machine left behind going down is read on */
+#define DRAIN_TIMEOUT       500
+
+int ProcessDebugData(int ttyfd, int timeout, int stage)
 {
     char Buffer[BUFFER_SIZE];
     char CacheBuffer[BUFFER_SIZE];
@@ -18,7 +21,6 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
     char* bp = Buffer;
     int got;
     int Ret = EXIT_DONT_CONTINUE;
-    int ttyfd;
     struct termios ttyattr, rawattr;
     unsigned int CacheHits = 0;
     unsigned int i;
@@ -28,68 +30,96 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
     bool Prompt = false;
     bool CheckpointReached = false;
     bool BrokeToDebugger = false;
+    bool Kdbg;
+    int EventFd = GetMachineEventFd();
+    int WriteFd = GetConsoleWriteFd();
+    bool Interactive = isatty(STDIN_FILENO);
+    int DefaultTimeout = timeout;
+    char Test[128];
+    unsigned int Executed, Failures;
+    char CurrentTest[128] = "";
+    unsigned long long Now, TestStart = 0, LastLine = 0, MaxGap = 0;
+    unsigned long long SilentSince, DrainUntil = 0;
+    unsigned int Silent, SpinTimeout;
+    int PollTimeout;
+    int Liveness = LIVENESS_UNKNOWN;
+    bool Expired;
+
+    /* Most transports take the commands on the same fd */
+    if (WriteFd < 0)
+        WriteFd = ttyfd;
 
     /* Initialize CacheBuffer with an empty string */
     *CacheBuffer = 0;
 
-    if (AppSettings.VMType == TYPE_VMWARE_PLAYER || AppSettings.VMType == TYPE_VIRTUALBOX)
+    MetricsBegin(PHASE_FIRST_BYTE);
+    MetricsBegin(PHASE_CHECKPOINT);
+
+    /* We also monitor STDIN_FILENO, so a user can cancel the process with ESC.
+       Without a terminal (e.g. when benchmarking), there's no one to press it */
+    if (Interactive)
     {
-        /* Wait for VMware connection */
-        if ((ttyfd = accept(AppSettings.Specific.VMwarePlayer.Socket, NULL, NULL)) < 0)
+        if (tcgetattr(STDIN_FILENO, &ttyattr) < 0)
         {
-            SysregPrintf("error getting socket\n");
+            SysregPrintf("tcgetattr failed with error %d\n", errno);
             return Ret;
         }
 
-        /* Set non blocking */
-        if (fcntl(ttyfd, F_SETFL, O_NONBLOCK) < 0)
-        {
-            SysregPrintf("error setting flag\n");
-            close(ttyfd);
-            return Ret;
-        }
-    }
-    else
-    {
-        /* ttyfd is the file descriptor of the virtual COM port */
-        if ((ttyfd = open(tty, O_NOCTTY | O_RDWR | O_NONBLOCK)) < 0)
+        rawattr = ttyattr;
+        rawattr.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP
+                                         | IGNCR | ICRNL | IXON);
+        rawattr.c_lflag &= ~(ICANON | ECHO | ECHONL);
+        rawattr.c_oflag &= ~OPOST;
+        rawattr.c_cflag &= ~(CSIZE | PARENB);
+        rawattr.c_cflag |= CS8;
+
+        if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &rawattr) < 0)
         {
-            SysregPrintf("error opening tty\n");
+            SysregPrintf("tcsetattr failed with error %d\n", errno);
             return Ret;
         }
     }
 
-    /* We also monitor STDIN_FILENO, so a user can cancel the process with ESC */
-    if (tcgetattr(STDIN_FILENO, &ttyattr) < 0)
-    {
-        SysregPrintf("tcgetattr failed with error %d\n", errno);
-        close(ttyfd);
-        return Ret;
-    }
-
-    rawattr = ttyattr;
-    rawattr.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP
-                                     | IGNCR | ICRNL | IXON);
-    rawattr.c_lflag &= ~(ICANON | ECHO | ECHONL);
-    rawattr.c_oflag &= ~OPOST;
-    rawattr.c_cflag &= ~(CSIZE | PARENB);
-    rawattr.c_cflag |= CS8;
-
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &rawattr) < 0)
-    {
-        SysregPrintf("tcsetattr failed with error %d\n", errno);
-        close(ttyfd);
-        return Ret;
-    }
+    FloodBegin(stage);
+    LivenessBegin();
+    SilentSince = MetricsNow();
 
     for(;;)
     {
         struct pollfd fds[] = {
-            { STDIN_FILENO, POLLIN, 0 },
+            { (Interactive ? STDIN_FILENO : -1), POLLIN, 0 },
             { ttyfd, POLLIN | POLLHUP | POLLERR, 0 },
+            /* Negative when the machine doesn't deliver events, poll ignores it then */
+            { (DrainUntil ? -1 : EventFd), POLLIN, 0 },
         };
 
-        got = poll(fds, (sizeof(fds) / sizeof(struct pollfd)), timeout);
+        /* Sampling the CPU time of a silent guest takes waking up before the timeout */
+        PollTimeout = timeout;
+        if (LivenessActive())
+        {
+            Silent = (MetricsNow() - SilentSince) / 1000000;
+            if (timeout >= 0)
+                PollTimeout = ((int)Silent < timeout ? timeout - (int)Silent : 0);
+            if (PollTimeout < 0 || PollTimeout > AppSettings.LivenessInterval)
+                PollTimeout = AppSettings.LivenessInterval;
+        }
+
+        /* The machine is gone, only what it wrote before is still read */
+        if (DrainUntil)
+        {
+            Now = MetricsNow();
+            if (Now >= DrainUntil)
+            {
+                Ret = EXIT_CONTINUE;
+                goto cleanup;
+            }
+
+            if (PollTimeout < 0 || PollTimeout > (int)((DrainUntil - Now) / 1000000) + 1)
+                PollTimeout = (int)((DrainUntil - Now) / 1000000) + 1;
+        }
+
+        got = poll(fds, (sizeof(fds) / sizeof(struct pollfd)), PollTimeout);
+        StatsAdd(STAT_POLLS, 1);
         if (got < 0)
         {
             /* Just try it again on simple errors */
@@ -99,20 +129,57 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
             SysregPrintf("poll failed with error %d\n", errno);
             goto cleanup;
         }
+        else if (got == 0 && DrainUntil)
+        {
+            /* Nothing left over */
+            Ret = EXIT_CONTINUE;
+            goto cleanup;
+        }
         else if (got == 0)
         {
+            Expired = true;
+
+            /* A guest burning its CPU without a word won't get any better by waiting,
+               an idle or otherwise busy one gets the whole timeout */
+            if (LivenessActive())
+            {
+                Liveness = LivenessSample();
+                Silent = (MetricsNow() - SilentSince) / 1000000;
+                SpinTimeout = (AppSettings.SpinTimeout ? AppSettings.SpinTimeout : (timeout >= 0 ? timeout / 3 : 0));
+
+                Expired = ((timeout >= 0 && (int)Silent >= timeout) ||
+                           (SpinTimeout && LivenessSpinning() >= SpinTimeout));
+
+                if (Expired && Liveness == LIVENESS_SPINNING && !BrokeToDebugger)
+                    SysregPrintf("Guest spinning for %u ms without output\n", LivenessSpinning());
+            }
+
             /* timeout - only break once then, quit */
-            if (!BreakToDebugger() || BrokeToDebugger)
+            if (Expired && (!BreakToDebugger() || BrokeToDebugger))
             {
-                SysregPrintf("timeout\n");
+                if (Liveness != LIVENESS_UNKNOWN)
+                    SysregPrintf("timeout, guest %s\n", LivenessName(Liveness));
+                else
+                    SysregPrintf("timeout\n");
+
+                /* Whatever KDBG had to say came in already, the host can still tell where the guest is */
+                HostBacktrace(stage);
                 Ret = EXIT_CONTINUE;
                 goto cleanup;
             }
-            else
+            else if (Expired)
             {
                 BrokeToDebugger = true;
+                SilentSince = MetricsNow();
+                LivenessReset();
             }
         }
+        else
+        {
+            /* Anything coming in starts the wait over, like it does for poll */
+            SilentSince = MetricsNow();
+            LivenessReset();
+        }
 
         /* Check for global timeout */
         if (time(0) >= AppSettings.GlobalTimeout)
@@ -125,7 +192,8 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
 
         for (i = 0; i < (sizeof(fds) / sizeof(struct pollfd)); i++)
         {
-            if ((fds[i].fd == ttyfd) && (
+            /* Whatever the guest wrote before hanging up is read first */
+            if ((fds[i].fd == ttyfd) && !(fds[i].revents & POLLIN) && (
                 (fds[i].revents & POLLHUP) ||
                 (fds[i].revents & POLLERR)))
             {
@@ -134,6 +202,23 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
                 goto cleanup;
             }
 
+            if ((fds[i].fd == EventFd) && (fds[i].revents & POLLIN))
+            {
+                int Events = ReadMachineEvents();
+
+                /* The machine went down or rebooted, move to next stage once the console
+                   has nothing left, the checkpoint may still be buffered */
+                if (Events & MACHINE_EVENT_CRASHED)
+                    SysregPrintf("machine crashed\n");
+
+                if (Events & (MACHINE_EVENT_CRASHED | MACHINE_EVENT_STOPPED | MACHINE_EVENT_REBOOTED))
+                {
+                    DrainUntil = MetricsNow() + DRAIN_TIMEOUT * 1000000ULL;
+                }
+
+                continue;
+            }
+
             /* Wait till we get some input from the fd */
             if (!(fds[i].revents & POLLIN))
                 continue;
@@ -146,6 +231,7 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
             while (bp - Buffer < (BUFFER_SIZE - 1))
             {
                 got = read(fds[i].fd, bp, 1);
+                StatsAdd(STAT_READS, 1);
 
                 if (got < 0)
                 {
@@ -166,6 +252,13 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
                     break;
                 }
 
+                if (fds[i].fd == ttyfd)
+                {
+                    MetricsEnd(PHASE_FIRST_BYTE);
+                    MetricsCount(COUNTER_BYTES, got);
+                    StatsAdd(STAT_BYTES, got);
+                }
+
                 if (fds[i].fd == STDIN_FILENO)
                 {
                     /* break on ESC */
@@ -211,8 +304,22 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
             if (*bp != '\n' && (bp - Buffer < (BUFFER_SIZE - 1)))
                 continue;
 
-            /* Hackish way to detect reboot under VMware... */
-            if (((AppSettings.VMType == TYPE_VMWARE_PLAYER) || (AppSettings.VMType == TYPE_VIRTUALBOX)) &&
+            MetricsCount(COUNTER_LINES, 1);
+
+            /* Where the modules are, for a backtrace from the host */
+            BacktraceModuleLine(Buffer);
+
+            /* Longest silence within the current test, for its history */
+            Now = MetricsNow();
+            if (*CurrentTest && Now - LastLine > MaxGap)
+                MaxGap = Now - LastLine;
+            LastLine = Now;
+            StatsAdd(STAT_LINES, 1);
+            StatsSet(STAT_LAST_LINE, Now);
+
+            /* Hackish way to detect reboot under VMware, when it doesn't tell us... */
+            if (EventFd < 0 &&
+                ((AppSettings.VMType == TYPE_VMWARE_PLAYER) || (AppSettings.VMType == TYPE_VIRTUALBOX)) &&
                 strstr(Buffer, "-----------------------------------------------------"))
             {
                 if (AlreadyBooted)
@@ -232,6 +339,7 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
             if(!strcmp(Buffer, CacheBuffer))
             {
                 ++CacheHits;
+                StatsAdd(STAT_CACHE_HITS, 1);
 
                 if(CacheHits > AppSettings.MaxCacheHits)
                 {
@@ -247,23 +355,76 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
                 CacheBuffer[bp - Buffer + 1] = 0;
             }
 
-            /* Output the line, raddr2line the included addresses if necessary */
+            /* Output the line, raddr2line the included addresses if necessary.
+               Lines of a flood are only kept for the tail */
             if (KdbgHit == 1 && ResolveAddressFromFile(Raddr2LineBuffer, sizeof(Raddr2LineBuffer), Buffer))
-                printf("%s", Raddr2LineBuffer);
+            {
+                if (FloodLine(Raddr2LineBuffer, true))
+                {
+                    printf("%s", Raddr2LineBuffer);
+                    SerialLogLine(stage, Raddr2LineBuffer, true);
+                }
+            }
             else
-                printf("%s", Buffer);
+            {
+                Kdbg = (KdbgHit != 0 || strstr(Buffer, "kdb:>"));
+                if (FloodLine(Buffer, Kdbg))
+                {
+                    printf("%s", Buffer);
+                    SerialLogLine(stage, Buffer, Kdbg);
+                }
+            }
+
+            if (FloodExceeded())
+            {
+                SysregPrintf("Output flood, canceled!\n");
+                Ret = EXIT_CONTINUE;
+                goto cleanup;
+            }
+
+            /* A new test: the previous one completed, and this one gets the idle timeout its history asks for */
+            if (GetTestName(Buffer, Test, sizeof(Test)))
+            {
+                /* Not if it had to be broken into, that's no healthy run */
+                if (*CurrentTest && !BrokeToDebugger)
+                    HistoryRecord(CurrentTest, (Now - TestStart) / 1000000, MaxGap / 1000000);
+
+                strcpy(CurrentTest, Test);
+                TestStart = Now;
+                MaxGap = 0;
+
+                if (!BrokeToDebugger)
+                {
+                    timeout = HistoryTimeout(Test, DefaultTimeout);
+                    if (timeout != DefaultTimeout)
+                        SysregPrintf("Idle timeout for %s: %d ms\n", Test, timeout);
+                }
+            }
+
+            /* Compare with the baseline as soon as a test tells its results, and stop a run that regressed too much */
+            if (*CurrentTest && GetTestResult(Buffer, &Executed, &Failures) && BaselineResult(CurrentTest, Executed, Failures))
+            {
+                SysregPrintf("Failure budget exceeded, canceled!\n");
+                Ret = EXIT_DONT_CONTINUE;
+                goto cleanup;
+            }
 
             /* Check for "magic" sequences */
             if (strstr(Buffer, "kdb:>"))
             {
                 ++KdbgHit;
+                StatsAdd(STAT_KDBG_HITS, 1);
 
                 if (KdbgHit == 1)
                 {
+                    /* Time in KDBG runs until we continue */
+                    if (!MetricsPending(PHASE_KDBG))
+                        MetricsBegin(PHASE_KDBG);
+
                     /* If we have a call to RtlAssert(),  break once
                      * Otherwise we hit Kdbg for the first time, get a backtrace for the log
                      */
-                    if (safewriteex(ttyfd, (Prompt ? "o\r" : "bt\r"), (Prompt ? 2 : 3), timeout) < 0
+                    if (safewriteex(WriteFd, (Prompt ? "o\r" : "bt\r"), (Prompt ? 2 : 3), timeout) < 0
                         && errno == EWOULDBLOCK)
                     {
                         /* timeout */
@@ -286,6 +447,8 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
                 else
                 {
                     ++Cont;
+                    MetricsCount(COUNTER_CONTS, 1);
+                    StatsAdd(STAT_CONTS, 1);
 
                     /* We won't cont if we reached max tries */
                     if (Cont <= AppSettings.MaxConts || BrokeToDebugger)
@@ -293,13 +456,14 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
                         KdbgHit = 0;
 
                         /* Try to continue */
-                        if (safewrite(ttyfd, "cont\r", timeout) < 0 && errno == EWOULDBLOCK)
+                        if (safewrite(WriteFd, "cont\r", timeout) < 0 && errno == EWOULDBLOCK)
                         {
                             /* timeout */
                             SysregPrintf("timeout\n");
                             Ret = EXIT_CONTINUE;
                             goto cleanup;
                         }
+                        MetricsEnd(PHASE_KDBG);
 
                         /* Reduce timeout to let ROS properly shutdown (if possible) */
                         if (BrokeToDebugger)
@@ -322,7 +486,7 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
             else if (strstr(Buffer, "--- Press q"))
             {
                 /* Send Return to get more data from Kdbg */
-                if (safewrite(ttyfd, "\r", timeout) < 0 && errno == EWOULDBLOCK)
+                if (safewrite(WriteFd, "\r", timeout) < 0 && errno == EWOULDBLOCK)
                 {
                     /* timeout */
                     SysregPrintf("timeout\n");
@@ -345,14 +509,24 @@ int ProcessDebugData(const char* tty, int timeout, int stage )
             {
                 /* We reached a checkpoint, so return success */
                 CheckpointReached = true;
+                MetricsEnd(PHASE_CHECKPOINT);
+
+                /* Which means the last test completed as well */
+                if (*CurrentTest && !BrokeToDebugger)
+                {
+                    HistoryRecord(CurrentTest, (Now - TestStart) / 1000000, MaxGap / 1000000);
+                    *CurrentTest = 0;
+                }
             }
         }
     }
 
 
 cleanup:
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &ttyattr);
-    close(ttyfd);
+    FloodEnd();
+    MetricsEnd(PHASE_KDBG);
+    if (Interactive)
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &ttyattr);
 
     return (CheckpointReached ? EXIT_CHECKPOINT_REACHED : Ret);
 }
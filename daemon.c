@@ -0,0 +1,590 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Daemon mode running queued test jobs, and its client
+ */
+
+#include "sysreg.h"
+#include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define MAX_CLIENTS         64
+#define MAX_SLOTS           16
+
+/* Output a client is allowed to fall behind with, before it is dropped */
+#define MAX_BACKLOG         (4 * 1024 * 1024)
+
+/* Protocol, one line per message:
+ *   client: RUN <config> [iso]
+ *   daemon: QUEUED <job> <position>, OUT <job> <line>, DONE <job> <result>
+ */
+
+typedef struct _Job
+{
+    struct _Job* Next;
+    unsigned int Id;
+    int Client;
+    char Config[255];
+    char Iso[255];
+    pid_t Pid;
+    int OutFd;
+    char Line[512];
+    size_t LineLength;
+}
+Job;
+
+typedef struct _Client
+{
+    int Fd;
+    char Input[600];
+    size_t InputLength;
+    char* Output;
+    size_t OutputLength;
+    size_t OutputSize;
+    Job* Queue;
+}
+Client;
+
+static Client Clients[MAX_CLIENTS];
+static Job* Slots[MAX_SLOTS];
+static unsigned int NextJobId = 1;
+static unsigned int LastClient = 0;
+static int Listener = -1;
+
+static void DropClient(int Index)
+{
+    Job* Current;
+    unsigned int i;
+
+    close(Clients[Index].Fd);
+    Clients[Index].Fd = -1;
+
+    free(Clients[Index].Output);
+    Clients[Index].Output = NULL;
+    Clients[Index].OutputLength = 0;
+    Clients[Index].OutputSize = 0;
+
+    /* Queued jobs go away with their client, running ones finish silently */
+    while ((Current = Clients[Index].Queue))
+    {
+        Clients[Index].Queue = Current->Next;
+        free(Current);
+    }
+
+    for (i = 0; i < MAX_SLOTS; i++)
+    {
+        if (Slots[i] && Slots[i]->Client == Index)
+            Slots[i]->Client = -1;
+    }
+}
+
+/* Send as much of the queued output as the client takes */
+static bool FlushClient(int Index)
+{
+    Client* Current = &Clients[Index];
+    ssize_t Sent;
+
+    while (Current->OutputLength)
+    {
+        Sent = send(Current->Fd, Current->Output, Current->OutputLength, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (Sent < 0)
+            return (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK);
+
+        Current->OutputLength -= Sent;
+        memmove(Current->Output, Current->Output + Sent, Current->OutputLength);
+    }
+
+    return true;
+}
+
+static bool QueueOutput(int Index, const char* Data, size_t Length)
+{
+    Client* Current = &Clients[Index];
+    char* Grown;
+    size_t Size;
+
+    if (Current->OutputLength + Length > MAX_BACKLOG)
+        return false;
+
+    if (Current->OutputLength + Length > Current->OutputSize)
+    {
+        Size = (Current->OutputSize ? Current->OutputSize : 4096);
+        while (Size < Current->OutputLength + Length)
+            Size *= 2;
+
+        Grown = (char*)realloc(Current->Output, Size);
+        if (!Grown)
+            return false;
+
+        Current->Output = Grown;
+        Current->OutputSize = Size;
+    }
+
+    memcpy(Current->Output + Current->OutputLength, Data, Length);
+    Current->OutputLength += Length;
+
+    /* Keep the order, only try right away when nothing was waiting already */
+    return (Current->OutputLength != Length || FlushClient(Index));
+}
+
+static void SendClient(int Index, const char* format, ...)
+{
+    char Message[600];
+    va_list args;
+    int Length;
+
+    if (Index < 0 || Clients[Index].Fd < 0)
+        return;
+
+    va_start(args, format);
+    Length = vsnprintf(Message, sizeof(Message), format, args);
+    va_end(args);
+
+    if (Length >= (int)sizeof(Message))
+    {
+        Length = sizeof(Message) - 1;
+        Message[Length - 1] = '\n';
+    }
+
+    /* Never let a slow client hold back the other jobs, what it doesn't take now is queued */
+    if (!QueueOutput(Index, Message, Length))
+    {
+        SysregPrintf("Dropping client %d\n", Index);
+        DropClient(Index);
+    }
+}
+
+static void QueueJob(int Index, char* Request)
+{
+    Job* NewJob;
+    Job** Last;
+    char* Config;
+    char* Iso;
+    unsigned int Position = 1;
+
+    if (strncmp(Request, "RUN ", 4))
+    {
+        SendClient(Index, "ERROR unknown request\n");
+        return;
+    }
+
+    Config = strtok(Request + 4, " ");
+    Iso = strtok(NULL, " ");
+    if (!Config)
+    {
+        SendClient(Index, "ERROR missing configuration\n");
+        return;
+    }
+
+    NewJob = (Job*)calloc(1, sizeof(Job));
+    NewJob->Id = NextJobId++;
+    NewJob->Client = Index;
+    NewJob->Pid = -1;
+    NewJob->OutFd = -1;
+    strncpy(NewJob->Config, Config, sizeof(NewJob->Config) - 1);
+    if (Iso)
+        strncpy(NewJob->Iso, Iso, sizeof(NewJob->Iso) - 1);
+
+    for (Last = &Clients[Index].Queue; *Last; Last = &(*Last)->Next)
+        ++Position;
+    *Last = NewJob;
+
+    SysregPrintf("Job %u queued: %s %s\n", NewJob->Id, NewJob->Config, NewJob->Iso);
+    SendClient(Index, "QUEUED %u %u\n", NewJob->Id, Position);
+}
+
+static void ReadClient(int Index)
+{
+    Client* Current = &Clients[Index];
+    char* End;
+    ssize_t got;
+
+    got = read(Current->Fd, Current->Input + Current->InputLength, sizeof(Current->Input) - Current->InputLength - 1);
+    if (got <= 0)
+    {
+        if (got < 0 && (errno == EINTR || errno == EAGAIN))
+            return;
+
+        DropClient(Index);
+        return;
+    }
+
+    Current->InputLength += got;
+    Current->Input[Current->InputLength] = 0;
+
+    while ((End = strchr(Current->Input, '\n')))
+    {
+        *End = 0;
+        if (End > Current->Input && End[-1] == '\r')
+            End[-1] = 0;
+
+        QueueJob(Index, Current->Input);
+        if (Current->Fd < 0)
+            return;
+
+        Current->InputLength -= End + 1 - Current->Input;
+        memmove(Current->Input, End + 1, Current->InputLength + 1);
+    }
+
+    if (Current->InputLength == sizeof(Current->Input) - 1)
+    {
+        SendClient(Index, "ERROR request too long\n");
+        Current->InputLength = 0;
+    }
+}
+
+pid_t SpawnTest(const char* Defaults, const char* XmlConfig, const char* IsoImage, int OutFd, int Instance)
+{
+    pid_t Pid;
+    int Null;
+    unsigned int i;
+
+    /* Anything buffered must not be written twice */
+    fflush(stdout);
+
+    Pid = fork();
+    if (Pid != 0)
+        return Pid;
+
+    /* The child inherits the module list, everything else is its own */
+    dup2(OutFd, STDOUT_FILENO);
+    dup2(OutFd, STDERR_FILENO);
+    Null = open("/dev/null", O_RDONLY);
+    if (Null >= 0)
+        dup2(Null, STDIN_FILENO);
+
+    signal(SIGPIPE, SIG_DFL);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    /* Without an exec, close-on-exec doesn't help. The daemon's sockets and pipes are none of the child's business */
+    if (Listener >= 0)
+    {
+        close(Listener);
+        for (i = 0; i < MAX_CLIENTS; i++)
+        {
+            if (Clients[i].Fd >= 0)
+                close(Clients[i].Fd);
+        }
+        for (i = 0; i < MAX_SLOTS; i++)
+        {
+            if (Slots[i] && Slots[i]->OutFd >= 0)
+                close(Slots[i]->OutFd);
+        }
+    }
+
+    /* Concurrent runs get different places on the host */
+    InstanceIndex = Instance;
+
+    if (Defaults && !ReadSettings(Defaults))
+    {
+        SysregPrintf("Cannot load configuration file %s\n", Defaults);
+        _exit(EXIT_DONT_CONTINUE);
+    }
+
+    _exit(RunTest(XmlConfig, IsoImage));
+}
+
+static bool StartJob(Job* Current, unsigned int Slot)
+{
+    int Pipe[2];
+
+    if (pipe2(Pipe, O_CLOEXEC) < 0)
+        return false;
+
+    Current->Pid = SpawnTest(NULL, Current->Config, (Current->Iso[0] ? Current->Iso : NULL), Pipe[1], Slot);
+    close(Pipe[1]);
+    if (Current->Pid < 0)
+    {
+        close(Pipe[0]);
+        return false;
+    }
+
+    Current->OutFd = Pipe[0];
+    fcntl(Current->OutFd, F_SETFL, O_NONBLOCK);
+
+    SysregPrintf("Job %u started (pid %d)\n", Current->Id, Current->Pid);
+    return true;
+}
+
+/* Round robin over the clients, so that no one can hog the slots */
+static void ScheduleJobs(int MaxSlots)
+{
+    unsigned int i, Slot;
+    int Index;
+    Job* Next;
+
+    for (Slot = 0; Slot < (unsigned int)MaxSlots; Slot++)
+    {
+        if (Slots[Slot])
+            continue;
+
+        Next = NULL;
+        for (i = 1; i <= MAX_CLIENTS && !Next; i++)
+        {
+            Index = (LastClient + i) % MAX_CLIENTS;
+            if (Clients[Index].Fd >= 0 && Clients[Index].Queue)
+            {
+                Next = Clients[Index].Queue;
+                Clients[Index].Queue = Next->Next;
+                LastClient = Index;
+            }
+        }
+
+        if (!Next)
+            return;
+
+        if (!StartJob(Next, Slot))
+        {
+            SendClient(Next->Client, "DONE %u %d\n", Next->Id, EXIT_DONT_CONTINUE);
+            free(Next);
+            continue;
+        }
+
+        Slots[Slot] = Next;
+    }
+}
+
+static void ReadJob(unsigned int Slot)
+{
+    Job* Current = Slots[Slot];
+    char b[512];
+    ssize_t got, i;
+    int Status;
+
+    got = read(Current->OutFd, b, sizeof(b));
+    if (got < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+
+    if (got > 0)
+    {
+        for (i = 0; i < got; i++)
+        {
+            Current->Line[Current->LineLength++] = b[i];
+            if (b[i] == '\n' || Current->LineLength == sizeof(Current->Line) - 2)
+            {
+                if (b[i] != '\n')
+                    Current->Line[Current->LineLength++] = '\n';
+                Current->Line[Current->LineLength] = 0;
+                SendClient(Current->Client, "OUT %u %s", Current->Id, Current->Line);
+                Current->LineLength = 0;
+            }
+        }
+        return;
+    }
+
+    /* The job is over */
+    if (Current->LineLength)
+    {
+        Current->Line[Current->LineLength] = 0;
+        SendClient(Current->Client, "OUT %u %s\n", Current->Id, Current->Line);
+    }
+
+    close(Current->OutFd);
+    while (waitpid(Current->Pid, &Status, 0) < 0 && errno == EINTR);
+
+    Status = (WIFEXITED(Status) ? WEXITSTATUS(Status) : EXIT_DONT_CONTINUE);
+    SysregPrintf("Job %u done: %d\n", Current->Id, Status);
+    SendClient(Current->Client, "DONE %u %d\n", Current->Id, Status);
+
+    free(Current);
+    Slots[Slot] = NULL;
+}
+
+int RunDaemon(const char* SocketPath, int MaxSlots)
+{
+    struct sockaddr_un addr;
+    struct pollfd fds[1 + MAX_CLIENTS + MAX_SLOTS];
+    int fd;
+    unsigned int i;
+
+    if (MaxSlots < 1)
+        MaxSlots = 1;
+    if (MaxSlots > MAX_SLOTS)
+        MaxSlots = MAX_SLOTS;
+
+    for (i = 0; i < MAX_CLIENTS; i++)
+        Clients[i].Fd = -1;
+
+    if ((Listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        SysregPrintf("Failed creating socket\n");
+        return EXIT_DONT_CONTINUE;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SocketPath, sizeof(addr.sun_path) - 1);
+
+    /* Safety measure */
+    unlink(SocketPath);
+
+    if (bind(Listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(Listener, 5) < 0)
+    {
+        SysregPrintf("Failed listening on %s\n", SocketPath);
+        close(Listener);
+        Listener = -1;
+        return EXIT_DONT_CONTINUE;
+    }
+
+    /* The daemon log is usually redirected, keep it current */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    signal(SIGPIPE, SIG_IGN);
+    SysregPrintf("Waiting for jobs on %s, %d slot(s)\n", SocketPath, MaxSlots);
+
+    for (;;)
+    {
+        fds[0].fd = Listener;
+        fds[0].events = POLLIN;
+        for (i = 0; i < MAX_CLIENTS; i++)
+        {
+            fds[1 + i].fd = Clients[i].Fd;
+            fds[1 + i].events = POLLIN | (Clients[i].OutputLength ? POLLOUT : 0);
+        }
+        for (i = 0; i < MAX_SLOTS; i++)
+        {
+            fds[1 + MAX_CLIENTS + i].fd = (Slots[i] ? Slots[i]->OutFd : -1);
+            fds[1 + MAX_CLIENTS + i].events = POLLIN;
+        }
+
+        if (poll(fds, (sizeof(fds) / sizeof(struct pollfd)), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            SysregPrintf("poll failed with error %d\n", errno);
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            fd = accept4(Listener, NULL, NULL, SOCK_CLOEXEC);
+            for (i = 0; fd >= 0 && i < MAX_CLIENTS; i++)
+            {
+                if (Clients[i].Fd < 0)
+                {
+                    Clients[i].Fd = fd;
+                    Clients[i].InputLength = 0;
+                    break;
+                }
+            }
+
+            if (fd >= 0 && i == MAX_CLIENTS)
+                close(fd);
+        }
+
+        for (i = 0; i < MAX_CLIENTS; i++)
+        {
+            if ((fds[1 + i].revents & POLLOUT) && Clients[i].Fd >= 0 && !FlushClient(i))
+            {
+                SysregPrintf("Dropping client %d\n", i);
+                DropClient(i);
+            }
+
+            if ((fds[1 + i].revents & ~POLLOUT) && Clients[i].Fd >= 0)
+                ReadClient(i);
+        }
+
+        for (i = 0; i < MAX_SLOTS; i++)
+        {
+            if (fds[1 + MAX_CLIENTS + i].revents && Slots[i])
+                ReadJob(i);
+        }
+
+        ScheduleJobs(MaxSlots);
+    }
+
+    close(Listener);
+    Listener = -1;
+    unlink(SocketPath);
+    return EXIT_DONT_CONTINUE;
+}
+
+int SubmitJob(const char* SocketPath, const char* XmlConfig, const char* IsoImage)
+{
+    struct sockaddr_un addr;
+    char Buffer[1024];
+    char AbsoluteConfig[PATH_MAX];
+    char AbsoluteIso[PATH_MAX];
+    size_t Length = 0;
+    char* End;
+    char* Line;
+    char* Payload;
+    unsigned int Id;
+    int Result;
+    int fd;
+    FILE* Request;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return EXIT_DONT_CONTINUE;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SocketPath, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        SysregPrintf("Cannot connect to %s\n", SocketPath);
+        close(fd);
+        return EXIT_DONT_CONTINUE;
+    }
+
+    /* The daemon may well run from another directory */
+    if (!realpath(XmlConfig, AbsoluteConfig) || (IsoImage && !realpath(IsoImage, AbsoluteIso)))
+    {
+        SysregPrintf("Cannot find %s\n", (IsoImage ? IsoImage : XmlConfig));
+        close(fd);
+        return EXIT_DONT_CONTINUE;
+    }
+
+    Request = fdopen(dup(fd), "w");
+    fprintf(Request, "RUN %s %s\n", AbsoluteConfig, (IsoImage ? AbsoluteIso : ""));
+    fclose(Request);
+
+    for (;;)
+    {
+        ssize_t got = read(fd, Buffer + Length, sizeof(Buffer) - Length - 1);
+
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+
+        Length += got;
+        Buffer[Length] = 0;
+
+        for (Line = Buffer; (End = strchr(Line, '\n')); Line = End + 1)
+        {
+            *End = 0;
+
+            if (!strncmp(Line, "OUT ", 4) && (Payload = strchr(Line + 4, ' ')))
+            {
+                printf("%s\n", Payload + 1);
+            }
+            else if (sscanf(Line, "DONE %u %d", &Id, &Result) == 2)
+            {
+                close(fd);
+                return Result;
+            }
+            else if (!strncmp(Line, "QUEUED ", 7) || !strncmp(Line, "ERROR ", 6))
+            {
+                SysregPrintf("%s\n", Line);
+            }
+        }
+
+        /* Keep what's left of an incomplete line */
+        Length = strlen(Line);
+        memmove(Buffer, Line, Length);
+
+        /* A line this long can't be stored, flush it */
+        if (Length == sizeof(Buffer) - 1)
+        {
+            printf("%s", Buffer);
+            Length = 0;
+        }
+    }
+
+    SysregPrintf("Lost connection to the daemon\n");
+    close(fd);
+    return EXIT_DONT_CONTINUE;
+}
@@ -0,0 +1,412 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Creating empty sparse disk images without external tools
+ */
+
+#include "sysreg.h"
+#include <ctype.h>
+#include <endian.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define QCOW2_MAGIC             0x514649fb
+#define QCOW2_CLUSTER_BITS      16
+#define QCOW2_CLUSTER_SIZE      (1 << QCOW2_CLUSTER_BITS)
+
+#define VDI_SIGNATURE           0xbeda107f
+#define VDI_VERSION             0x00010001
+#define VDI_TYPE_DYNAMIC        1
+#define VDI_BLOCK_SIZE          (1024 * 1024)
+#define VDI_UNALLOCATED         0xffffffff
+#define VDI_BLOCKS_OFFSET       512
+
+/* 1.44 MB, 2 FATs of 9 sectors, 224 root entries, one sector per cluster */
+#define FLOPPY_SECTOR_SIZE      512
+#define FLOPPY_SECTORS          2880
+#define FLOPPY_FAT_SECTORS      9
+#define FLOPPY_ROOT_ENTRIES     224
+#define FLOPPY_ROOT_SECTOR      (1 + 2 * FLOPPY_FAT_SECTORS)
+#define FLOPPY_DATA_SECTOR      (FLOPPY_ROOT_SECTOR + FLOPPY_ROOT_ENTRIES * 32 / FLOPPY_SECTOR_SIZE)
+#define FLOPPY_MEDIA            0xf0
+
+#pragma pack(push, 1)
+
+/* Version 2 header, big endian */
+typedef struct _Qcow2Header
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t BackingFileOffset;
+    uint32_t BackingFileSize;
+    uint32_t ClusterBits;
+    uint64_t Size;
+    uint32_t CryptMethod;
+    uint32_t L1Size;
+    uint64_t L1TableOffset;
+    uint64_t RefcountTableOffset;
+    uint32_t RefcountTableClusters;
+    uint32_t NbSnapshots;
+    uint64_t SnapshotsOffset;
+}
+Qcow2Header;
+
+typedef struct _VdiGeometry
+{
+    uint32_t Cylinders;
+    uint32_t Heads;
+    uint32_t Sectors;
+    uint32_t SectorSize;
+}
+VdiGeometry;
+
+/* Pre-header and version 1.1 header, little endian */
+typedef struct _VdiHeader
+{
+    char FileInfo[64];
+    uint32_t Signature;
+    uint32_t Version;
+    uint32_t HeaderSize;
+    uint32_t Type;
+    uint32_t Flags;
+    char Comment[256];
+    uint32_t BlocksOffset;
+    uint32_t DataOffset;
+    VdiGeometry LegacyGeometry;
+    uint32_t Dummy;
+    uint64_t DiskSize;
+    uint32_t BlockSize;
+    uint32_t BlockExtra;
+    uint32_t Blocks;
+    uint32_t BlocksAllocated;
+    unsigned char CreateUuid[16];
+    unsigned char ModifyUuid[16];
+    unsigned char LinkageUuid[16];
+    unsigned char ParentModifyUuid[16];
+    VdiGeometry Geometry;
+}
+VdiHeader;
+
+typedef struct _FatBootSector
+{
+    unsigned char Jump[3];
+    char OemName[8];
+    uint16_t BytesPerSector;
+    uint8_t SectorsPerCluster;
+    uint16_t ReservedSectors;
+    uint8_t Fats;
+    uint16_t RootEntries;
+    uint16_t Sectors;
+    uint8_t Media;
+    uint16_t SectorsPerFat;
+    uint16_t SectorsPerTrack;
+    uint16_t Heads;
+    uint32_t HiddenSectors;
+    uint32_t LargeSectors;
+    uint8_t DriveNumber;
+    uint8_t Reserved;
+    uint8_t Signature;
+    uint32_t SerialNumber;
+    char Label[11];
+    char FileSystem[8];
+}
+FatBootSector;
+
+typedef struct _FatDirEntry
+{
+    char Name[11];
+    uint8_t Attributes;
+    uint8_t Reserved[10];
+    uint16_t Time;
+    uint16_t Date;
+    uint16_t FirstCluster;
+    uint32_t Size;
+}
+FatDirEntry;
+
+#pragma pack(pop)
+
+static bool WriteAt(int fd, const void* Data, size_t Length, off_t Offset)
+{
+    ssize_t r;
+
+    while (Length > 0)
+    {
+        r = pwrite(fd, Data, Length, Offset);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+
+        Data = (const char*)Data + r;
+        Length -= r;
+        Offset += r;
+    }
+
+    return true;
+}
+
+static bool CreateRaw(int fd, unsigned long long Size)
+{
+    /* Nothing but a hole */
+    return (ftruncate(fd, Size) == 0);
+}
+
+/* Header, refcount table, one refcount block and the L1 table, each in its own cluster */
+static bool CreateQcow2(int fd, unsigned long long Size)
+{
+    Qcow2Header Header;
+    unsigned long long L2Coverage = (unsigned long long)QCOW2_CLUSTER_SIZE * (QCOW2_CLUSTER_SIZE / 8);
+    uint32_t L1Size = (uint32_t)((Size + L2Coverage - 1) / L2Coverage);
+    uint32_t L1Clusters = (L1Size * 8 + QCOW2_CLUSTER_SIZE - 1) / QCOW2_CLUSTER_SIZE;
+    uint32_t Clusters = 3 + (L1Clusters ? L1Clusters : 1);
+    uint64_t RefcountBlock = htobe64(2ULL * QCOW2_CLUSTER_SIZE);
+    uint16_t Refcount = htobe16(1);
+    uint32_t i;
+
+    /* One refcount block covers the metadata of images up to a few TB */
+    if (Clusters > QCOW2_CLUSTER_SIZE / 2)
+        return false;
+
+    memset(&Header, 0, sizeof(Header));
+    Header.Magic = htobe32(QCOW2_MAGIC);
+    Header.Version = htobe32(2);
+    Header.ClusterBits = htobe32(QCOW2_CLUSTER_BITS);
+    Header.Size = htobe64(Size);
+    Header.L1Size = htobe32(L1Size);
+    Header.L1TableOffset = htobe64(3ULL * QCOW2_CLUSTER_SIZE);
+    Header.RefcountTableOffset = htobe64(1ULL * QCOW2_CLUSTER_SIZE);
+    Header.RefcountTableClusters = htobe32(1);
+
+    /* Zeroed clusters first, the L1 table has no L2 table yet */
+    if (ftruncate(fd, (off_t)Clusters * QCOW2_CLUSTER_SIZE) != 0 ||
+        !WriteAt(fd, &Header, sizeof(Header), 0) ||
+        !WriteAt(fd, &RefcountBlock, sizeof(RefcountBlock), QCOW2_CLUSTER_SIZE))
+        return false;
+
+    /* Every cluster of the file is in use once */
+    for (i = 0; i < Clusters; i++)
+    {
+        if (!WriteAt(fd, &Refcount, sizeof(Refcount), 2 * QCOW2_CLUSTER_SIZE + i * sizeof(Refcount)))
+            return false;
+    }
+
+    return true;
+}
+
+static bool GenerateUuid(unsigned char* Uuid)
+{
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    bool Ret;
+
+    if (fd < 0)
+        return false;
+
+    Ret = (read(fd, Uuid, 16) == 16);
+    close(fd);
+
+    /* Random, version 4 */
+    Uuid[6] = (Uuid[6] & 0x0f) | 0x40;
+    Uuid[8] = (Uuid[8] & 0x3f) | 0x80;
+    return Ret;
+}
+
+/* Dynamic image: header and a block map with nothing allocated */
+static bool CreateVdi(int fd, unsigned long long Size)
+{
+    VdiHeader Header;
+    uint32_t Blocks = (uint32_t)((Size + VDI_BLOCK_SIZE - 1) / VDI_BLOCK_SIZE);
+    uint32_t MapSize = (Blocks * 4 + 511) & ~511U;
+    uint32_t* Map;
+    uint32_t i;
+    bool Ret;
+
+    memset(&Header, 0, sizeof(Header));
+    strcpy(Header.FileInfo, "<<< Oracle VM VirtualBox Disk Image >>>\n");
+    Header.Signature = htole32(VDI_SIGNATURE);
+    Header.Version = htole32(VDI_VERSION);
+    Header.HeaderSize = htole32(sizeof(VdiHeader) - offsetof(VdiHeader, HeaderSize));
+    Header.Type = htole32(VDI_TYPE_DYNAMIC);
+    Header.BlocksOffset = htole32(VDI_BLOCKS_OFFSET);
+    Header.DataOffset = htole32(VDI_BLOCKS_OFFSET + MapSize);
+    Header.LegacyGeometry.SectorSize = htole32(512);
+    Header.DiskSize = htole64(Size);
+    Header.BlockSize = htole32(VDI_BLOCK_SIZE);
+    Header.Blocks = htole32(Blocks);
+
+    /* A new UUID each time, so VirtualBox doesn't mistake it for the previous disk */
+    if (!GenerateUuid(Header.CreateUuid) || !GenerateUuid(Header.ModifyUuid))
+        return false;
+
+    Map = (uint32_t*)malloc(MapSize);
+    if (!Map)
+        return false;
+
+    memset(Map, 0, MapSize);
+    for (i = 0; i < Blocks; i++)
+        Map[i] = htole32(VDI_UNALLOCATED);
+
+    Ret = WriteAt(fd, &Header, sizeof(Header), 0) &&
+          WriteAt(fd, Map, MapSize, VDI_BLOCKS_OFFSET) &&
+          ftruncate(fd, VDI_BLOCKS_OFFSET + MapSize) == 0;
+
+    free(Map);
+    return Ret;
+}
+
+/* False if the format isn't supported here, or the image couldn't be written */
+bool CreateDiskImage(const char* Path, const char* Format, unsigned long long Size)
+{
+    bool (*Create)(int, unsigned long long);
+    bool Ret;
+    int fd;
+
+    if (!strcmp(Format, "raw"))
+        Create = CreateRaw;
+    else if (!strcmp(Format, "qcow2"))
+        Create = CreateQcow2;
+    else if (!strcmp(Format, "vdi"))
+        Create = CreateVdi;
+    else
+        return false;
+
+    fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        SysregPrintf("Cannot create %s: %d\n", Path, errno);
+        return false;
+    }
+
+    Ret = Create(fd, Size);
+    if (close(fd) != 0)
+        Ret = false;
+
+    if (!Ret)
+    {
+        SysregPrintf("Failed writing %s image %s\n", Format, Path);
+        unlink(Path);
+    }
+
+    return Ret;
+}
+
+static void SetFat12Entry(unsigned char* Fat, unsigned int Cluster, unsigned int Value)
+{
+    unsigned int Offset = Cluster + Cluster / 2;
+
+    if (Cluster & 1)
+    {
+        Fat[Offset] = (Fat[Offset] & 0x0f) | ((Value << 4) & 0xf0);
+        Fat[Offset + 1] = (Value >> 4) & 0xff;
+    }
+    else
+    {
+        Fat[Offset] = Value & 0xff;
+        Fat[Offset + 1] = (Fat[Offset + 1] & 0xf0) | ((Value >> 8) & 0x0f);
+    }
+}
+
+/* "NAME.EXT" to the padded 8.3 form of a directory entry */
+static void SetShortName(char* Entry, const char* Name, size_t Size)
+{
+    const char* Dot = strchr(Name, '.');
+    size_t BaseLength = (Dot ? (size_t)(Dot - Name) : strlen(Name));
+    size_t i;
+
+    memset(Entry, ' ', Size);
+    for (i = 0; i < BaseLength && i < 8; i++)
+        Entry[i] = toupper((unsigned char)Name[i]);
+    for (i = 0; Dot && Dot[1 + i] && i < 3; i++)
+        Entry[8 + i] = toupper((unsigned char)Dot[1 + i]);
+}
+
+/* A FAT12 floppy with a single file in the root directory, labeled SYSREG */
+bool CreateFloppyImage(const char* Path, const char* FileName, const char* Data, size_t Length)
+{
+    unsigned char* Image;
+    FatBootSector* Boot;
+    FatDirEntry* Entry;
+    unsigned int Clusters = (Length + FLOPPY_SECTOR_SIZE - 1) / FLOPPY_SECTOR_SIZE;
+    unsigned int Fat, i;
+    struct tm Now;
+    time_t Time = time(NULL);
+    bool Ret;
+    int fd;
+
+    if (Clusters > FLOPPY_SECTORS - FLOPPY_DATA_SECTOR)
+    {
+        SysregPrintf("%lu bytes don't fit on a floppy\n", (unsigned long)Length);
+        return false;
+    }
+
+    /* The whole image is written at once */
+    Image = (unsigned char*)calloc(FLOPPY_SECTORS, FLOPPY_SECTOR_SIZE);
+    if (!Image)
+        return false;
+
+    Boot = (FatBootSector*)Image;
+    memcpy(Boot->Jump, "\xeb\x3c\x90", 3);
+    memcpy(Boot->OemName, "SYSREG2 ", 8);
+    Boot->BytesPerSector = htole16(FLOPPY_SECTOR_SIZE);
+    Boot->SectorsPerCluster = 1;
+    Boot->ReservedSectors = htole16(1);
+    Boot->Fats = 2;
+    Boot->RootEntries = htole16(FLOPPY_ROOT_ENTRIES);
+    Boot->Sectors = htole16(FLOPPY_SECTORS);
+    Boot->Media = FLOPPY_MEDIA;
+    Boot->SectorsPerFat = htole16(FLOPPY_FAT_SECTORS);
+    Boot->SectorsPerTrack = htole16(18);
+    Boot->Heads = htole16(2);
+    Boot->Signature = 0x29;
+    Boot->SerialNumber = htole32((uint32_t)Time);
+    memcpy(Boot->Label, "SYSREG     ", 11);
+    memcpy(Boot->FileSystem, "FAT12   ", 8);
+    Image[510] = 0x55;
+    Image[511] = 0xaa;
+
+    /* The file takes consecutive clusters from the first one on */
+    for (Fat = 0; Fat < 2; Fat++)
+    {
+        unsigned char* Table = Image + (1 + Fat * FLOPPY_FAT_SECTORS) * FLOPPY_SECTOR_SIZE;
+
+        SetFat12Entry(Table, 0, 0xf00 | FLOPPY_MEDIA);
+        SetFat12Entry(Table, 1, 0xfff);
+        for (i = 0; i < Clusters; i++)
+            SetFat12Entry(Table, 2 + i, (i + 1 < Clusters ? 3 + i : 0xfff));
+    }
+
+    localtime_r(&Time, &Now);
+
+    Entry = (FatDirEntry*)(Image + FLOPPY_ROOT_SECTOR * FLOPPY_SECTOR_SIZE);
+    memcpy(Entry->Name, "SYSREG     ", 11);
+    Entry->Attributes = 0x08;
+
+    ++Entry;
+    SetShortName(Entry->Name, FileName, sizeof(Entry->Name));
+    Entry->Attributes = 0x20;
+    Entry->Time = htole16((Now.tm_hour << 11) | (Now.tm_min << 5) | (Now.tm_sec / 2));
+    Entry->Date = htole16(((Now.tm_year - 80) << 9) | ((Now.tm_mon + 1) << 5) | Now.tm_mday);
+    Entry->FirstCluster = htole16(Clusters ? 2 : 0);
+    Entry->Size = htole32((uint32_t)Length);
+
+    memcpy(Image + FLOPPY_DATA_SECTOR * FLOPPY_SECTOR_SIZE, Data, Length);
+
+    fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        SysregPrintf("Cannot create %s: %d\n", Path, errno);
+        free(Image);
+        return false;
+    }
+
+    Ret = WriteAt(fd, Image, FLOPPY_SECTORS * FLOPPY_SECTOR_SIZE, 0);
+    if (close(fd) != 0 || !Ret)
+    {
+        SysregPrintf("Failed writing floppy image %s\n", Path);
+        unlink(Path);
+        Ret = false;
+    }
+
+    free(Image);
+    return Ret;
+}
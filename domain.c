@@ -0,0 +1,511 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Domain definition template, parsed once and rendered on every launch
+ */
+
+#include "sysreg.h"
+
+typedef struct _DomainTemplate
+{
+    xmlDocPtr Doc;
+    /* Patch points, found once when loading */
+    xmlNodePtr Boot;
+    xmlNodePtr Name;
+    xmlNodePtr DiskSource;
+    xmlNodePtr DiskDriver;
+    xmlNodePtr DiskTarget;
+    xmlNodePtr CdromSource;
+    xmlNodePtr FloppySource;
+    xmlNodePtr Devices;
+    xmlNodePtr Serial;
+    xmlNodePtr Console;
+    xmlNodePtr Vcpu;
+    xmlNodePtr OnReboot;
+    /* Last rendering, reused as long as nothing was patched */
+    xmlChar* Rendered;
+    int RenderedLength;
+    char RenderedBootDevice[8];
+}
+DomainTemplate;
+
+static DomainTemplate Template;
+
+static xmlNodePtr FindNode(xmlXPathContextPtr ctxt, const char* Path)
+{
+    xmlXPathObjectPtr obj;
+    xmlNodePtr Node = NULL;
+
+    obj = xmlXPathEval(BAD_CAST Path, ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NODESET)
+            && (obj->nodesetval != NULL) && (obj->nodesetval->nodeNr > 0))
+    {
+        Node = obj->nodesetval->nodeTab[0];
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    return Node;
+}
+
+static void InvalidateRendering(void)
+{
+    if (Template.Rendered)
+    {
+        xmlFree(Template.Rendered);
+        Template.Rendered = NULL;
+    }
+}
+
+bool LoadDomainTemplate(const char* XmlFileName)
+{
+    xmlXPathContextPtr ctxt;
+
+    FreeDomainTemplate();
+
+    Template.Doc = xmlReadFile(XmlFileName, NULL,
+                               XML_PARSE_NOENT | XML_PARSE_NONET |
+                               XML_PARSE_NOWARNING);
+    if (!Template.Doc)
+        return false;
+
+    ctxt = xmlXPathNewContext(Template.Doc);
+    if (!ctxt)
+    {
+        FreeDomainTemplate();
+        return false;
+    }
+
+    Template.Boot = FindNode(ctxt, "/domain/os/boot");
+    Template.Name = FindNode(ctxt, "/domain/name");
+    Template.DiskSource = FindNode(ctxt, "/domain/devices/disk[@device='disk']/source");
+    Template.DiskDriver = FindNode(ctxt, "/domain/devices/disk[@device='disk']/driver");
+    Template.DiskTarget = FindNode(ctxt, "/domain/devices/disk[@device='disk']/target");
+    Template.CdromSource = FindNode(ctxt, "/domain/devices/disk[@device='cdrom']/source");
+    Template.FloppySource = FindNode(ctxt, "/domain/devices/disk[@device='floppy']/source");
+    Template.Devices = FindNode(ctxt, "/domain/devices");
+    Template.Serial = FindNode(ctxt, "/domain/devices/serial");
+    Template.Console = FindNode(ctxt, "/domain/devices/console");
+    Template.Vcpu = FindNode(ctxt, "/domain/vcpu");
+    Template.OnReboot = FindNode(ctxt, "/domain/on_reboot");
+
+    xmlXPathFreeContext(ctxt);
+    return true;
+}
+
+void FreeDomainTemplate(void)
+{
+    InvalidateRendering();
+
+    if (Template.Doc)
+        xmlFreeDoc(Template.Doc);
+
+    memset(&Template, 0, sizeof(Template));
+}
+
+xmlDocPtr GetDomainTemplate(void)
+{
+    return Template.Doc;
+}
+
+void DomainTemplateChanged(void)
+{
+    InvalidateRendering();
+}
+
+const char* GetDomainDiskImage(void)
+{
+    xmlAttrPtr Attr;
+
+    if (!Template.DiskSource)
+        return NULL;
+
+    /* Point directly into the tree, nothing to free */
+    Attr = xmlHasProp(Template.DiskSource, BAD_CAST "file");
+    if (!Attr || !Attr->children)
+        return NULL;
+
+    return (const char*)Attr->children->content;
+}
+
+/* What libvirt does when the guest reboots, "restart" if not told */
+bool DomainRestartsOnReboot(void)
+{
+    xmlChar* Action;
+    bool Ret;
+
+    if (!Template.OnReboot)
+        return true;
+
+    Action = xmlNodeGetContent(Template.OnReboot);
+    Ret = (!Action || !xmlStrcmp(Action, BAD_CAST "restart"));
+    xmlFree(Action);
+    return Ret;
+}
+
+void SetDomainDiskImage(const char* Path)
+{
+    if (!Template.DiskSource)
+        return;
+
+    xmlSetProp(Template.DiskSource, BAD_CAST "file", BAD_CAST Path);
+    InvalidateRendering();
+}
+
+static xmlNodePtr GetDiskDriver(void)
+{
+    /* Without a driver element, libvirt assumes raw */
+    if (!Template.DiskDriver)
+    {
+        Template.DiskDriver = xmlNewChild(Template.DiskSource->parent, NULL, BAD_CAST "driver", NULL);
+        xmlSetProp(Template.DiskDriver, BAD_CAST "name", BAD_CAST "qemu");
+        xmlSetProp(Template.DiskDriver, BAD_CAST "type", BAD_CAST "raw");
+    }
+
+    return Template.DiskDriver;
+}
+
+void SetDomainDiskFormat(const char* Format)
+{
+    if (!Template.DiskSource)
+        return;
+
+    xmlSetProp(GetDiskDriver(), BAD_CAST "type", BAD_CAST Format);
+    InvalidateRendering();
+}
+
+/* Cache and io modes of the hard disk, and the bus it's on. NULL leaves one as is */
+bool SetDomainDiskTuning(const char* Cache, const char* Io, const char* Bus)
+{
+    if (!Template.DiskSource)
+        return false;
+
+    if (Cache)
+        xmlSetProp(GetDiskDriver(), BAD_CAST "cache", BAD_CAST Cache);
+    if (Io)
+        xmlSetProp(GetDiskDriver(), BAD_CAST "io", BAD_CAST Io);
+
+    if (Bus)
+    {
+        if (!Template.DiskTarget)
+            Template.DiskTarget = xmlNewChild(Template.DiskSource->parent, NULL, BAD_CAST "target", NULL);
+
+        /* The device name has to go with the bus */
+        xmlSetProp(Template.DiskTarget, BAD_CAST "bus", BAD_CAST Bus);
+        if (!strcmp(Bus, "virtio"))
+            xmlSetProp(Template.DiskTarget, BAD_CAST "dev", BAD_CAST "vda");
+        else if (!strcmp(Bus, "ide"))
+            xmlSetProp(Template.DiskTarget, BAD_CAST "dev", BAD_CAST "hda");
+        else
+            xmlSetProp(Template.DiskTarget, BAD_CAST "dev", BAD_CAST "sda");
+    }
+
+    InvalidateRendering();
+    return true;
+}
+
+void SetDomainCdromImage(const char* Path)
+{
+    if (!Template.CdromSource)
+        return;
+
+    xmlSetProp(Template.CdromSource, BAD_CAST "file", BAD_CAST Path);
+    InvalidateRendering();
+}
+
+/* Insert a floppy drive if the domain has none */
+bool SetDomainFloppyImage(const char* Path)
+{
+    xmlNodePtr Disk, Node;
+
+    if (!Template.FloppySource)
+    {
+        if (!Template.Devices)
+            return false;
+
+        Disk = xmlNewChild(Template.Devices, NULL, BAD_CAST "disk", NULL);
+        xmlSetProp(Disk, BAD_CAST "type", BAD_CAST "file");
+        xmlSetProp(Disk, BAD_CAST "device", BAD_CAST "floppy");
+        Template.FloppySource = xmlNewChild(Disk, NULL, BAD_CAST "source", NULL);
+        Node = xmlNewChild(Disk, NULL, BAD_CAST "target", NULL);
+        xmlSetProp(Node, BAD_CAST "dev", BAD_CAST "fda");
+        xmlSetProp(Node, BAD_CAST "bus", BAD_CAST "fdc");
+        xmlNewChild(Disk, NULL, BAD_CAST "readonly", NULL);
+    }
+
+    xmlSetProp(Template.FloppySource, BAD_CAST "file", BAD_CAST Path);
+    InvalidateRendering();
+    return true;
+}
+
+void SetDomainName(const char* Name)
+{
+    if (!Template.Name)
+        return;
+
+    xmlNodeSetContent(Template.Name, BAD_CAST Name);
+    InvalidateRendering();
+}
+
+/* Copy running next to the others of the same template: libvirt picks a UUID,
+   the MAC address and the VNC port differ */
+void SetDomainCopy(unsigned int Copy)
+{
+    xmlXPathContextPtr ctxt;
+    xmlNodePtr Node;
+    xmlChar* Mac;
+    unsigned int Last;
+    char Value[32];
+
+    if (!Template.Doc)
+        return;
+
+    ctxt = xmlXPathNewContext(Template.Doc);
+    if (!ctxt)
+        return;
+
+    if ((Node = FindNode(ctxt, "/domain/uuid")))
+    {
+        xmlUnlinkNode(Node);
+        xmlFreeNode(Node);
+    }
+
+    if ((Node = FindNode(ctxt, "/domain/devices/interface/mac")) && (Mac = xmlGetProp(Node, BAD_CAST "address")))
+    {
+        if (strlen((char*)Mac) == 17 && sscanf((char*)Mac + 15, "%x", &Last) == 1)
+        {
+            snprintf(Value, sizeof(Value), "%.15s%02x", (char*)Mac, (Last + Copy) & 0xff);
+            xmlSetProp(Node, BAD_CAST "address", BAD_CAST Value);
+        }
+        xmlFree(Mac);
+    }
+
+    if ((Node = FindNode(ctxt, "/domain/devices/graphics[@port]")))
+    {
+        xmlUnsetProp(Node, BAD_CAST "port");
+        xmlSetProp(Node, BAD_CAST "autoport", BAD_CAST "yes");
+    }
+
+    xmlXPathFreeContext(ctxt);
+    InvalidateRendering();
+}
+
+/* Turn a character device into a unix socket QEMU connects to */
+static void SetUnixSource(xmlNodePtr Device, const char* Path)
+{
+    xmlNodePtr Child, Next, Source = NULL;
+
+    xmlSetProp(Device, BAD_CAST "type", BAD_CAST "unix");
+    xmlUnsetProp(Device, BAD_CAST "tty");
+
+    for (Child = Device->children; Child; Child = Next)
+    {
+        Next = Child->next;
+        if (Child->type != XML_ELEMENT_NODE || xmlStrcmp(Child->name, BAD_CAST "source"))
+            continue;
+
+        /* Only one source for a socket */
+        if (Source)
+        {
+            xmlUnlinkNode(Child);
+            xmlFreeNode(Child);
+            continue;
+        }
+
+        Source = Child;
+    }
+
+    if (!Source)
+        Source = xmlNewChild(Device, NULL, BAD_CAST "source", NULL);
+
+    xmlSetProp(Source, BAD_CAST "mode", BAD_CAST "connect");
+    xmlSetProp(Source, BAD_CAST "path", BAD_CAST Path);
+}
+
+bool SetDomainSerialSocket(const char* Path)
+{
+    if (!Template.Devices)
+        return false;
+
+    if (!Template.Serial)
+    {
+        Template.Serial = xmlNewChild(Template.Devices, NULL, BAD_CAST "serial", NULL);
+        xmlSetProp(xmlNewChild(Template.Serial, NULL, BAD_CAST "target", NULL), BAD_CAST "port", BAD_CAST "0");
+    }
+
+    SetUnixSource(Template.Serial, Path);
+
+    /* The console is the same port as the serial, or libvirt adds it on its own */
+    if (Template.Console)
+        SetUnixSource(Template.Console, Path);
+
+    InvalidateRendering();
+    return true;
+}
+
+unsigned int GetDomainVcpus(void)
+{
+    xmlChar* Content;
+    unsigned int Vcpus;
+
+    if (!Template.Vcpu)
+        return 1;
+
+    Content = xmlNodeGetContent(Template.Vcpu);
+    Vcpus = (Content ? (unsigned int)atoi((char*)Content) : 1);
+    xmlFree(Content);
+
+    return Vcpus;
+}
+
+void SetDomainVcpus(unsigned int Vcpus)
+{
+    char Value[16];
+
+    if (!Template.Doc)
+        return;
+
+    if (!Template.Vcpu)
+        Template.Vcpu = xmlNewChild(xmlDocGetRootElement(Template.Doc), NULL, BAD_CAST "vcpu", NULL);
+
+    snprintf(Value, sizeof(Value), "%u", Vcpus);
+    xmlNodeSetContent(Template.Vcpu, BAD_CAST Value);
+    InvalidateRendering();
+}
+
+/* Remove the devices named Name, only those of type Type unless NULL. Returns how many */
+unsigned int RemoveDomainDevices(const char* Name, const char* Type)
+{
+    xmlNodePtr Child, Next;
+    xmlChar* DeviceType;
+    unsigned int Removed = 0;
+    bool Match;
+
+    if (!Template.Devices)
+        return 0;
+
+    for (Child = Template.Devices->children; Child; Child = Next)
+    {
+        Next = Child->next;
+        if (Child->type != XML_ELEMENT_NODE || xmlStrcmp(Child->name, BAD_CAST Name))
+            continue;
+
+        Match = true;
+        if (Type)
+        {
+            DeviceType = xmlGetProp(Child, BAD_CAST "type");
+            Match = (DeviceType && !xmlStrcmp(DeviceType, BAD_CAST Type));
+            xmlFree(DeviceType);
+        }
+
+        if (!Match)
+            continue;
+
+        /* Keep the patch points valid */
+        if (Child == Template.Serial)
+            Template.Serial = NULL;
+        if (Child == Template.Console)
+            Template.Console = NULL;
+        if (Template.DiskSource && Child == Template.DiskSource->parent)
+            Template.DiskSource = Template.DiskDriver = Template.DiskTarget = NULL;
+        if (Template.CdromSource && Child == Template.CdromSource->parent)
+            Template.CdromSource = NULL;
+        if (Template.FloppySource && Child == Template.FloppySource->parent)
+            Template.FloppySource = NULL;
+
+        xmlUnlinkNode(Child);
+        xmlFreeNode(Child);
+        ++Removed;
+    }
+
+    if (Removed)
+        InvalidateRendering();
+
+    return Removed;
+}
+
+/* Replace an element of the domain by an empty one */
+static xmlNodePtr ReplaceElement(const char* Name)
+{
+    xmlNodePtr Root = xmlDocGetRootElement(Template.Doc);
+    xmlNodePtr Child, Next;
+
+    for (Child = Root->children; Child; Child = Next)
+    {
+        Next = Child->next;
+        if (Child->type == XML_ELEMENT_NODE && !xmlStrcmp(Child->name, BAD_CAST Name))
+        {
+            xmlUnlinkNode(Child);
+            xmlFreeNode(Child);
+        }
+    }
+
+    return xmlNewChild(Root, NULL, BAD_CAST Name, NULL);
+}
+
+/* vCPU and emulator pinning, and the memory on Node unless negative */
+bool SetDomainPlacement(const unsigned int* VcpuPins, unsigned int Vcpus, unsigned int EmulatorCpu, int Node)
+{
+    xmlNodePtr CpuTune, NumaTune, Pin;
+    char Value[16];
+    unsigned int i;
+
+    if (!Template.Doc)
+        return false;
+
+    CpuTune = ReplaceElement("cputune");
+    for (i = 0; i < Vcpus; i++)
+    {
+        Pin = xmlNewChild(CpuTune, NULL, BAD_CAST "vcpupin", NULL);
+        snprintf(Value, sizeof(Value), "%u", i);
+        xmlSetProp(Pin, BAD_CAST "vcpu", BAD_CAST Value);
+        snprintf(Value, sizeof(Value), "%u", VcpuPins[i]);
+        xmlSetProp(Pin, BAD_CAST "cpuset", BAD_CAST Value);
+    }
+
+    Pin = xmlNewChild(CpuTune, NULL, BAD_CAST "emulatorpin", NULL);
+    snprintf(Value, sizeof(Value), "%u", EmulatorCpu);
+    xmlSetProp(Pin, BAD_CAST "cpuset", BAD_CAST Value);
+
+    if (Node >= 0)
+    {
+        NumaTune = ReplaceElement("numatune");
+        Pin = xmlNewChild(NumaTune, NULL, BAD_CAST "memory", NULL);
+        snprintf(Value, sizeof(Value), "%d", Node);
+        xmlSetProp(Pin, BAD_CAST "mode", BAD_CAST "strict");
+        xmlSetProp(Pin, BAD_CAST "nodeset", BAD_CAST Value);
+    }
+
+    InvalidateRendering();
+    return true;
+}
+
+/* Guest memory from huge pages, the host has to have them reserved */
+bool SetDomainHugepages(void)
+{
+    if (!Template.Doc)
+        return false;
+
+    xmlNewChild(ReplaceElement("memoryBacking"), NULL, BAD_CAST "hugepages", NULL);
+    InvalidateRendering();
+    return true;
+}
+
+const char* RenderDomainXml(const char* BootDevice)
+{
+    if (!Template.Doc)
+        return NULL;
+
+    if (Template.Rendered && !strcmp(Template.RenderedBootDevice, BootDevice))
+        return (const char*)Template.Rendered;
+
+    InvalidateRendering();
+
+    if (Template.Boot)
+        xmlSetProp(Template.Boot, BAD_CAST "dev", BAD_CAST BootDevice);
+
+    xmlDocDumpMemory(Template.Doc, &Template.Rendered, &Template.RenderedLength);
+    strncpy(Template.RenderedBootDevice, BootDevice, sizeof(Template.RenderedBootDevice) - 1);
+
+    return (const char*)Template.Rendered;
+}
@@ -0,0 +1,233 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Bounding the output relayed from a flooding machine
+ */
+
+#include "sysreg.h"
+
+#define MIN_TAIL_SIZE       4096
+#define RATE_WINDOW         1000000000ULL
+
+/* Each stage relays lines until it has relayed FloodBytes KB (the head), or
+ * until more than FloodRate lines arrive within a second. From then on,
+ * lines only go to a ring of the last FloodTail KB, and whatever falls out
+ * of it is counted as dropped. The ring is relayed once the rate flood
+ * calms down or the stage ends. A stage over its byte budget keeps only
+ * the tail until it ends.
+ *
+ * Ring entries are a Kdbg flag byte, the line, and a terminating 0.
+ */
+
+static char* Ring;
+static size_t RingSize;
+static size_t RingStart;
+static size_t RingUsed;
+static int CurrentStage;
+static bool Flooding;
+static bool OverBudget;
+static unsigned long long StageBytes;
+static unsigned long long WindowStart;
+static unsigned int WindowLines;
+static unsigned long long DroppedLines;
+static unsigned long long DroppedBytes;
+static unsigned long long StageDropped;
+
+static bool FloodEnabled(void)
+{
+    return (AppSettings.FloodBytes > 0 || AppSettings.FloodRate > 0);
+}
+
+/* Removes the oldest entry */
+static void PopEntry(void)
+{
+    size_t Length = 0;
+
+    /* Skip the flag, then the line up to its 0 */
+    RingStart = (RingStart + 1) % RingSize;
+    --RingUsed;
+
+    while (Ring[RingStart] != 0)
+    {
+        RingStart = (RingStart + 1) % RingSize;
+        --RingUsed;
+        ++Length;
+    }
+
+    RingStart = (RingStart + 1) % RingSize;
+    --RingUsed;
+
+    ++DroppedLines;
+    DroppedBytes += Length;
+    StageDropped += Length;
+    MetricsCount(COUNTER_DROPPED, 1);
+    StatsAdd(STAT_DROPPED, 1);
+}
+
+static void PushEntry(const char* Line, bool Kdbg)
+{
+    size_t Length = strlen(Line);
+    size_t End, i;
+
+    /* Flag and terminator, a line never takes more than the ring */
+    if (Length + 2 > RingSize)
+        Length = RingSize - 2;
+
+    while (RingSize - RingUsed < Length + 2)
+        PopEntry();
+
+    End = (RingStart + RingUsed) % RingSize;
+    Ring[End] = (Kdbg ? '1' : '0');
+    End = (End + 1) % RingSize;
+
+    for (i = 0; i < Length; i++)
+    {
+        Ring[End] = Line[i];
+        End = (End + 1) % RingSize;
+    }
+
+    Ring[End] = 0;
+    RingUsed += Length + 2;
+}
+
+/* Relays what the ring holds, after telling how much was lost before it */
+static void FlushRing(void)
+{
+    char Line[BUFSIZ];
+    size_t Length;
+    bool Kdbg;
+
+    if (DroppedLines)
+        SysregPrintf("Output flood: %llu lines (%llu bytes) dropped, the last %lu bytes follow\n",
+                     DroppedLines, DroppedBytes, (unsigned long)RingUsed);
+
+    while (RingUsed > 0)
+    {
+        Kdbg = (Ring[RingStart] == '1');
+        RingStart = (RingStart + 1) % RingSize;
+        --RingUsed;
+
+        Length = 0;
+        while (Ring[RingStart] != 0)
+        {
+            if (Length < sizeof(Line) - 1)
+                Line[Length++] = Ring[RingStart];
+
+            RingStart = (RingStart + 1) % RingSize;
+            --RingUsed;
+        }
+
+        RingStart = (RingStart + 1) % RingSize;
+        --RingUsed;
+
+        Line[Length] = 0;
+        printf("%s", Line);
+        SerialLogLine(CurrentStage, Line, Kdbg);
+    }
+
+    RingStart = 0;
+    DroppedLines = 0;
+    DroppedBytes = 0;
+}
+
+bool FloodBegin(int Stage)
+{
+    CurrentStage = Stage;
+    Flooding = false;
+    OverBudget = false;
+    StageBytes = 0;
+    WindowStart = MetricsNow();
+    WindowLines = 0;
+    RingStart = 0;
+    RingUsed = 0;
+    DroppedLines = 0;
+    DroppedBytes = 0;
+    StageDropped = 0;
+
+    if (!FloodEnabled() || Ring)
+        return true;
+
+    RingSize = (size_t)AppSettings.FloodTail * 1024;
+    if (RingSize < MIN_TAIL_SIZE)
+        RingSize = MIN_TAIL_SIZE;
+
+    /* The only memory the flood handling ever takes */
+    Ring = (char*)malloc(RingSize);
+    if (!Ring)
+    {
+        SysregPrintf("Cannot allocate the output ring, no flood handling\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* True if the line is to be relayed now, otherwise the ring took it */
+bool FloodLine(const char* Line, bool Kdbg)
+{
+    unsigned long long Now;
+    size_t Length;
+
+    if (!Ring)
+        return true;
+
+    Now = MetricsNow();
+    Length = strlen(Line);
+
+    /* A calm second ends a rate flood */
+    if (Now - WindowStart >= RATE_WINDOW)
+    {
+        if (Flooding && !OverBudget && (AppSettings.FloodRate == 0 || WindowLines <= AppSettings.FloodRate))
+        {
+            FlushRing();
+            Flooding = false;
+        }
+
+        WindowStart = Now;
+        WindowLines = 0;
+    }
+
+    ++WindowLines;
+
+    if (!Flooding && AppSettings.FloodRate > 0 && WindowLines > AppSettings.FloodRate)
+    {
+        SysregPrintf("Output flood: more than %u lines per second, keeping the last %lu KB\n",
+                     AppSettings.FloodRate, (unsigned long)(RingSize / 1024));
+        Flooding = true;
+    }
+
+    if (!OverBudget && AppSettings.FloodBytes > 0 && StageBytes + Length > (unsigned long long)AppSettings.FloodBytes * 1024)
+    {
+        SysregPrintf("Output flood: the stage relayed %u KB, keeping the last %lu KB\n",
+                     AppSettings.FloodBytes, (unsigned long)(RingSize / 1024));
+        Flooding = true;
+        OverBudget = true;
+    }
+
+    if (!Flooding)
+    {
+        StageBytes += Length;
+        return true;
+    }
+
+    PushEntry(Line, Kdbg);
+    return false;
+}
+
+/* True once more than FloodAbort KB had to be dropped in this stage */
+bool FloodExceeded(void)
+{
+    return (AppSettings.FloodAbort > 0 && StageDropped > (unsigned long long)AppSettings.FloodAbort * 1024);
+}
+
+void FloodEnd(void)
+{
+    if (!Ring)
+        return;
+
+    FlushRing();
+    Flooding = false;
+
+    free(Ring);
+    Ring = NULL;
+}
@@ -0,0 +1,299 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Per-test history of durations and silent gaps, for adaptive idle timeouts
+ */
+
+#include "sysreg.h"
+#include <sys/file.h>
+
+#define HISTORY_SAMPLES     32
+#define HISTORY_MIN_SAMPLES 3
+
+/* The history file has one line per test:
+ *   <test> <duration ms>:<longest silent gap ms> ...
+ * with the most recent HISTORY_SAMPLES runs that ran to completion.
+ * Runs at the same time may share the file, so saving merges with what
+ * the others saved meanwhile.
+ */
+
+typedef struct _TestHistory
+{
+    char Name[128];
+    unsigned int Count;
+    unsigned int Next;
+    unsigned int Duration[HISTORY_SAMPLES];
+    unsigned int Gap[HISTORY_SAMPLES];
+    /* The newest samples, recorded by this run and not saved yet */
+    unsigned int Added;
+}
+TestHistory;
+
+static TestHistory* History;
+static unsigned int HistoryCount;
+static unsigned int HistorySize;
+static bool HistoryChanged;
+
+static TestHistory* FindTest(const char* Name, bool Create)
+{
+    unsigned int i;
+
+    for (i = 0; i < HistoryCount; i++)
+    {
+        if (!strcmp(History[i].Name, Name))
+            return &History[i];
+    }
+
+    if (!Create)
+        return NULL;
+
+    if (HistoryCount == HistorySize)
+    {
+        TestHistory* Grown;
+
+        HistorySize = (HistorySize ? HistorySize * 2 : 256);
+        Grown = (TestHistory*)realloc(History, HistorySize * sizeof(TestHistory));
+        if (!Grown)
+            return NULL;
+
+        History = Grown;
+    }
+
+    memset(&History[HistoryCount], 0, sizeof(TestHistory));
+    strncpy(History[HistoryCount].Name, Name, sizeof(History[HistoryCount].Name) - 1);
+    return &History[HistoryCount++];
+}
+
+static void AddSample(TestHistory* Test, unsigned int Duration, unsigned int Gap)
+{
+    Test->Duration[Test->Next] = Duration;
+    Test->Gap[Test->Next] = Gap;
+    Test->Next = (Test->Next + 1) % HISTORY_SAMPLES;
+    if (Test->Count < HISTORY_SAMPLES)
+        ++Test->Count;
+}
+
+static int CompareSamples(const void* a, const void* b)
+{
+    unsigned int x = *(const unsigned int*)a;
+    unsigned int y = *(const unsigned int*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Samples this run recorded go on top of those in the file */
+static void ReadHistory(FILE* File)
+{
+    char Line[HISTORY_SAMPLES * 24 + 160];
+    char Name[128];
+    char* Sample;
+    unsigned int Duration, Gap;
+    unsigned int AddedDuration[HISTORY_SAMPLES];
+    unsigned int AddedGap[HISTORY_SAMPLES];
+    unsigned int i, Slot;
+    int Length;
+
+    while (fgets(Line, sizeof(Line), File))
+    {
+        TestHistory* Test;
+
+        if (sscanf(Line, "%127s%n", Name, &Length) != 1)
+            continue;
+
+        Test = FindTest(Name, true);
+        if (!Test)
+            break;
+
+        for (i = 0; i < Test->Added; i++)
+        {
+            Slot = (Test->Next + HISTORY_SAMPLES - Test->Added + i) % HISTORY_SAMPLES;
+            AddedDuration[i] = Test->Duration[Slot];
+            AddedGap[i] = Test->Gap[Slot];
+        }
+
+        /* Oldest first, so that the ring buffer ends up in the same order */
+        Test->Count = 0;
+        Test->Next = 0;
+        for (Sample = strtok(Line + Length, " \n"); Sample; Sample = strtok(NULL, " \n"))
+        {
+            if (sscanf(Sample, "%u:%u", &Duration, &Gap) == 2)
+                AddSample(Test, Duration, Gap);
+        }
+
+        for (i = 0; i < Test->Added; i++)
+            AddSample(Test, AddedDuration[i], AddedGap[i]);
+    }
+}
+
+bool LoadHistory(void)
+{
+    FILE* File;
+
+    HistoryCount = 0;
+    HistoryChanged = false;
+
+    if (!AppSettings.HistoryFile[0])
+        return true;
+
+    /* No history yet, it starts with this run */
+    File = fopen(AppSettings.HistoryFile, "r");
+    if (!File)
+        return (errno == ENOENT);
+
+    ReadHistory(File);
+    fclose(File);
+    return true;
+}
+
+bool SaveHistory(void)
+{
+    FILE* File;
+    char TempPath[260];
+    unsigned int i, j;
+    int Lock;
+    bool Ret = true;
+
+    if (!AppSettings.HistoryFile[0] || !HistoryChanged)
+        return true;
+
+    /* One run at a time takes in what the others saved since we loaded */
+    snprintf(TempPath, sizeof(TempPath), "%s.lock", AppSettings.HistoryFile);
+    Lock = open(TempPath, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (Lock >= 0)
+        flock(Lock, LOCK_EX);
+
+    File = fopen(AppSettings.HistoryFile, "r");
+    if (File)
+    {
+        ReadHistory(File);
+        fclose(File);
+    }
+
+    /* Same as the metrics, readers never see half a file */
+    snprintf(TempPath, sizeof(TempPath), "%s.tmp", AppSettings.HistoryFile);
+    File = fopen(TempPath, "w");
+    if (!File)
+    {
+        SysregPrintf("Failed opening %s: %d\n", TempPath, errno);
+        Ret = false;
+        goto done;
+    }
+
+    for (i = 0; i < HistoryCount; i++)
+    {
+        TestHistory* Test = &History[i];
+        unsigned int First = (Test->Count < HISTORY_SAMPLES ? 0 : Test->Next);
+
+        fprintf(File, "%s", Test->Name);
+        for (j = 0; j < Test->Count; j++)
+            fprintf(File, " %u:%u", Test->Duration[(First + j) % HISTORY_SAMPLES], Test->Gap[(First + j) % HISTORY_SAMPLES]);
+        fprintf(File, "\n");
+    }
+
+    if (fclose(File) != 0 || rename(TempPath, AppSettings.HistoryFile) < 0)
+    {
+        SysregPrintf("Failed writing history to %s: %d\n", AppSettings.HistoryFile, errno);
+        unlink(TempPath);
+        Ret = false;
+        goto done;
+    }
+
+    /* Saved now, another save must not add them again */
+    for (i = 0; i < HistoryCount; i++)
+        History[i].Added = 0;
+    HistoryChanged = false;
+
+done:
+    if (Lock >= 0)
+        close(Lock);
+
+    return Ret;
+}
+
+void FreeHistory(void)
+{
+    free(History);
+    History = NULL;
+    HistoryCount = 0;
+    HistorySize = 0;
+}
+
+/* A test that ran to its end, Duration and Gap in ms */
+void HistoryRecord(const char* Test, unsigned int Duration, unsigned int Gap)
+{
+    TestHistory* Entry;
+
+    if (!AppSettings.HistoryFile[0])
+        return;
+
+    Entry = FindTest(Test, true);
+    if (!Entry)
+        return;
+
+    AddSample(Entry, Duration, Gap);
+    if (Entry->Added < HISTORY_SAMPLES)
+        ++Entry->Added;
+    HistoryChanged = true;
+}
+
+/* Idle timeout for a test: p99 of its longest silent gaps times the factor, clamped */
+int HistoryTimeout(const char* Test, int Default)
+{
+    TestHistory* Entry;
+    unsigned int Gaps[HISTORY_SAMPLES];
+    unsigned int Index;
+    double Timeout;
+
+    if (!AppSettings.HistoryFile[0])
+        return Default;
+
+    Entry = FindTest(Test, false);
+    if (!Entry || Entry->Count < HISTORY_MIN_SAMPLES)
+        return Default;
+
+    memcpy(Gaps, Entry->Gap, Entry->Count * sizeof(unsigned int));
+    qsort(Gaps, Entry->Count, sizeof(unsigned int), CompareSamples);
+
+    Index = (Entry->Count * 99 + 99) / 100 - 1;
+    Timeout = Gaps[Index] * AppSettings.TimeoutFactor;
+
+    if (Timeout < AppSettings.MinTimeout)
+        Timeout = AppSettings.MinTimeout;
+    if (Timeout > AppSettings.MaxTimeout)
+        Timeout = AppSettings.MaxTimeout;
+
+    return (int)Timeout;
+}
+
+static unsigned int MedianDuration(const TestHistory* Entry)
+{
+    unsigned int Durations[HISTORY_SAMPLES];
+
+    memcpy(Durations, Entry->Duration, Entry->Count * sizeof(unsigned int));
+    qsort(Durations, Entry->Count, sizeof(unsigned int), CompareSamples);
+
+    return Durations[Entry->Count / 2];
+}
+
+/* Expected duration in ms of a test, or of all the tests of a module, 0 if unknown */
+unsigned int HistoryDuration(const char* Name)
+{
+    TestHistory* Entry;
+    size_t Length;
+    unsigned int Total = 0, i;
+
+    if (strchr(Name, ':'))
+    {
+        Entry = FindTest(Name, false);
+        return (Entry && Entry->Count ? MedianDuration(Entry) : 0);
+    }
+
+    Length = strlen(Name);
+    for (i = 0; i < HistoryCount; i++)
+    {
+        if (History[i].Count && !strncmp(History[i].Name, Name, Length) && History[i].Name[Length] == ':')
+            Total += MedianDuration(&History[i]);
+    }
+
+    return Total;
+}
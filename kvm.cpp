@@ -8,13 +8,366 @@
  */
 
 #include "machine.h"
+#include <libvirt-qemu.h>
 
 KVM::KVM()
 {
+    vStream = NULL;
+    Bridge[0] = -1;
+    Bridge[1] = -1;
+    BridgeWatch = -1;
+    StreamWatch = false;
+    Closing = false;
+    Draining = false;
+    pthread_mutex_init(&Lock, NULL);
+
     vConn = virConnectOpen("qemu:///session");
+
+    /* Serial port through a socket we own, QEMU connects to it */
+    SocketSerial = false;
+    if (AppSettings.Specific.KVM.SerialSocket[0])
+    {
+        SocketSerial = SetDomainSerialSocket(AppSettings.Specific.KVM.SerialSocket);
+        if (!SocketSerial)
+            SysregPrintf("No devices in the domain, keeping its serial port\n");
+    }
+}
+
+bool KVM::PrepareSerialPort()
+{
+    if (SocketSerial)
+        return PrepareTransport("unix", AppSettings.Specific.KVM.SerialSocket);
+
+    return LibVirt::PrepareSerialPort();
+}
+
+int KVM::OpenConsole()
+{
+    char console[50];
+
+    /* A transport from the settings is used as is */
+    if (Serial)
+        return OpenTransport();
+
+    /* Prefer streaming the console through libvirt, this also works remotely */
+    if (OpenConsoleStream())
+    {
+        ConsoleFd = Bridge[0];
+        return ConsoleFd;
+    }
+
+    if (!GetConsolePath(console))
+    {
+        SysregPrintf("GetConsole failed!\n");
+        return -1;
+    }
+
+    Serial = new PtyTransport(console);
+    return OpenTransport();
+}
+
+void KVM::CloseConsole()
+{
+    if (vStream == NULL)
+    {
+        LibVirt::CloseConsole();
+        return;
+    }
+
+    /* Make sure the event loop doesn't touch anything we're about to free */
+    pthread_mutex_lock(&Lock);
+    Closing = true;
+    if (BridgeWatch >= 0)
+    {
+        virEventRemoveHandle(BridgeWatch);
+        BridgeWatch = -1;
+    }
+    /* Gone already if the guest hung up */
+    if (StreamWatch)
+    {
+        virStreamEventRemoveCallback(vStream);
+        StreamWatch = false;
+    }
+    pthread_mutex_unlock(&Lock);
+
+    virStreamAbort(vStream);
+    virStreamFree(vStream);
+    vStream = NULL;
+
+    close(Bridge[0]);
+    close(Bridge[1]);
+    Bridge[0] = -1;
+    Bridge[1] = -1;
+    ConsoleFd = -1;
+}
+
+bool KVM::MonitorCommand(const char* Command, char* Result, size_t Size) const
+{
+    char* Answer = NULL;
+
+    if (vDom == NULL || virDomainQemuMonitorCommand(vDom, Command, &Answer, VIR_DOMAIN_QEMU_MONITOR_COMMAND_HMP) < 0)
+        return false;
+
+    snprintf(Result, Size, "%s", Answer);
+    free(Answer);
+    return true;
+}
+
+bool KVM::OpenConsoleStream()
+{
+    if (!StartEventLoop())
+        return false;
+
+    vStream = virStreamNew(vConn, VIR_STREAM_NONBLOCK);
+    if (!vStream)
+        return false;
+
+    if (virDomainOpenConsole(vDom, NULL, vStream, VIR_DOMAIN_CONSOLE_FORCE) < 0)
+    {
+        SysregPrintf("virDomainOpenConsole failed, falling back to pty\n");
+        virStreamFree(vStream);
+        vStream = NULL;
+        return false;
+    }
+
+    /* The console side of the pair is handed to ProcessDebugData,
+       the other one is bridged to the stream from the event loop */
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, Bridge) < 0)
+    {
+        virStreamAbort(vStream);
+        virStreamFree(vStream);
+        vStream = NULL;
+        return false;
+    }
+
+    Closing = false;
+    Draining = false;
+    ToConsoleLen = 0;
+    ToConsoleOffset = 0;
+    ToGuestLen = 0;
+
+    BridgeWatch = virEventAddHandle(Bridge[1], VIR_EVENT_HANDLE_READABLE, BridgeCallback, this, NULL);
+    StreamWatch = (BridgeWatch >= 0 &&
+                   virStreamEventAddCallback(vStream, VIR_STREAM_EVENT_READABLE, StreamCallback, this, NULL) == 0);
+    if (!StreamWatch)
+    {
+        CloseConsole();
+        return false;
+    }
+
+    return true;
+}
+
+void KVM::StreamCallback(virStreamPtr stream, int events, void* opaque)
+{
+    KVM* Self = (KVM*)opaque;
+    int got;
+
+    (void)stream;
+
+    pthread_mutex_lock(&Self->Lock);
+    /* Hung up already, the bridge drains the rest */
+    if (Self->Closing || Self->Draining)
+    {
+        pthread_mutex_unlock(&Self->Lock);
+        return;
+    }
+
+    if (events & VIR_STREAM_EVENT_WRITABLE)
+        Self->FlushToGuest();
+
+    /* Only receive once the previous chunk reached the console */
+    if (!Self->Closing && (events & VIR_STREAM_EVENT_READABLE) && Self->ToConsoleLen == 0)
+    {
+        got = virStreamRecv(Self->vStream, Self->ToConsole, sizeof(Self->ToConsole));
+        if (got > 0)
+        {
+            Self->ToConsoleLen = got;
+            Self->ToConsoleOffset = 0;
+            if (!Self->FlushToConsole())
+                Self->EndBridge();
+        }
+        else if (got != -2)
+        {
+            /* EOF or error: the guest is gone */
+            Self->HangUp();
+        }
+    }
+
+    if (!Self->Closing && !Self->Draining && (events & (VIR_STREAM_EVENT_ERROR | VIR_STREAM_EVENT_HANGUP)))
+        Self->HangUp();
+
+    Self->UpdateWatches();
+    pthread_mutex_unlock(&Self->Lock);
+}
+
+void KVM::BridgeCallback(int watch, int fd, int events, void* opaque)
+{
+    KVM* Self = (KVM*)opaque;
+    ssize_t got;
+
+    (void)watch;
+
+    pthread_mutex_lock(&Self->Lock);
+    if (Self->Closing)
+    {
+        pthread_mutex_unlock(&Self->Lock);
+        return;
+    }
+
+    /* The guest is gone, the console only takes in what the stream had left */
+    if (Self->Draining)
+    {
+        if (events & VIR_EVENT_HANDLE_WRITABLE)
+            Self->HangUp();
+        else if (events & (VIR_EVENT_HANDLE_ERROR | VIR_EVENT_HANDLE_HANGUP))
+            Self->EndBridge();
+
+        Self->UpdateWatches();
+        pthread_mutex_unlock(&Self->Lock);
+        return;
+    }
+
+    if ((events & VIR_EVENT_HANDLE_WRITABLE) && !Self->FlushToConsole())
+        Self->EndBridge();
+
+    /* Commands from the console, like "bt" or "cont" */
+    if (!Self->Closing && (events & VIR_EVENT_HANDLE_READABLE) && Self->ToGuestLen == 0)
+    {
+        got = read(fd, Self->ToGuest, sizeof(Self->ToGuest));
+        if (got > 0)
+        {
+            Self->ToGuestLen = got;
+            Self->FlushToGuest();
+        }
+        else if (got == 0 || (errno != EAGAIN && errno != EINTR))
+        {
+            /* Nobody reads the console any more */
+            Self->EndBridge();
+        }
+    }
+
+    if (!Self->Closing && (events & (VIR_EVENT_HANDLE_ERROR | VIR_EVENT_HANDLE_HANGUP)))
+        Self->EndBridge();
+
+    Self->UpdateWatches();
+    pthread_mutex_unlock(&Self->Lock);
+}
+
+/* False if the console is gone */
+bool KVM::FlushToConsole()
+{
+    while (ToConsoleOffset < ToConsoleLen)
+    {
+        ssize_t r = write(Bridge[1], ToConsole + ToConsoleOffset, ToConsoleLen - ToConsoleOffset);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        /* The console is lagging behind, wait for it */
+        if (r < 0 && errno == EAGAIN)
+            return true;
+        if (r < 0)
+            return false;
+
+        ToConsoleOffset += r;
+    }
+
+    ToConsoleLen = 0;
+    ToConsoleOffset = 0;
+    return true;
+}
+
+void KVM::FlushToGuest()
+{
+    int r;
+
+    if (ToGuestLen == 0 || Draining)
+        return;
+
+    r = virStreamSend(vStream, ToGuest, ToGuestLen);
+    /* Stream is busy, wait for it */
+    if (r == -2)
+        return;
+    if (r < 0)
+    {
+        HangUp();
+        return;
+    }
+
+    memmove(ToGuest, ToGuest + r, ToGuestLen - r);
+    ToGuestLen -= r;
+}
+
+void KVM::UpdateWatches()
+{
+    if (Closing)
+        return;
+
+    if (Draining)
+    {
+        virEventUpdateHandle(BridgeWatch, (ToConsoleLen != 0 ? VIR_EVENT_HANDLE_WRITABLE : 0));
+        return;
+    }
+
+    virStreamEventUpdateCallback(vStream, (ToConsoleLen == 0 ? VIR_STREAM_EVENT_READABLE : 0) |
+                                          (ToGuestLen != 0 ? VIR_STREAM_EVENT_WRITABLE : 0));
+    virEventUpdateHandle(BridgeWatch, (ToGuestLen == 0 ? VIR_EVENT_HANDLE_READABLE : 0) |
+                                      (ToConsoleLen != 0 ? VIR_EVENT_HANDLE_WRITABLE : 0));
+}
+
+/* The guest is gone: what the stream still holds goes to the console first,
+   the checkpoint or the last KDBG output may be in there */
+void KVM::HangUp()
+{
+    int got;
+
+    if (StreamWatch)
+    {
+        virStreamEventRemoveCallback(vStream);
+        StreamWatch = false;
+    }
+    Draining = true;
+
+    for (;;)
+    {
+        if (!FlushToConsole())
+            break;
+
+        /* Carry on once the console read some */
+        if (ToConsoleLen != 0)
+            return;
+
+        got = virStreamRecv(vStream, ToConsole, sizeof(ToConsole));
+        if (got <= 0)
+            break;
+
+        ToConsoleLen = got;
+        ToConsoleOffset = 0;
+    }
+
+    EndBridge();
+}
+
+/* Let the console see the hangup, as it would with the pty */
+void KVM::EndBridge()
+{
+    Closing = true;
+    shutdown(Bridge[1], SHUT_WR);
+
+    if (BridgeWatch >= 0)
+    {
+        virEventRemoveHandle(BridgeWatch);
+        BridgeWatch = -1;
+    }
+
+    if (StreamWatch)
+    {
+        virStreamEventRemoveCallback(vStream);
+        StreamWatch = false;
+    }
 }
 
-bool KVM::GetConsole(char* console)
+bool KVM::GetConsolePath(char* console)
 {
     xmlDocPtr xml = NULL;
     xmlXPathObjectPtr obj = NULL;
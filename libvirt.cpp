@@ -9,15 +9,396 @@
 
 #include "machine.h"
 
+static void* EventLoopThread(void* Context)
+{
+    (void)Context;
+
+    for (;;)
+    {
+        if (virEventRunDefaultImpl() < 0)
+        {
+            SysregPrintf("virEventRunDefaultImpl failed\n");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+bool LibVirt::StartEventLoop()
+{
+    static bool Started = false;
+    static bool Available = false;
+    pthread_t Thread;
+
+    /* The event implementation has to be registered before any connection is opened */
+    if (Started)
+        return Available;
+
+    Started = true;
+
+    if (virEventRegisterDefaultImpl() < 0)
+    {
+        SysregPrintf("Failed registering libvirt event loop\n");
+        return false;
+    }
+
+    if (pthread_create(&Thread, NULL, EventLoopThread, NULL) != 0)
+    {
+        SysregPrintf("Failed starting libvirt event loop\n");
+        return false;
+    }
+
+    pthread_detach(Thread);
+    Available = true;
+    return true;
+}
+
 LibVirt::LibVirt()
 {
     vConn = NULL;
+    vDom = NULL;
+    ConsoleFd = -1;
+    Serial = NULL;
+    LifecycleCallbackId = -1;
+    RebootCallbackId = -1;
+    ResourcesPipe = -1;
+    PendingEvents = 0;
+    Stopped = 0;
+
+    if (pipe2(EventPipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        EventPipe[0] = -1;
+        EventPipe[1] = -1;
+        return;
+    }
+
+    StartEventLoop();
 }
 
 LibVirt::~LibVirt()
 {
+    StopResources();
+    DeregisterEvents();
+
     if (vConn)
         virConnectClose(vConn);
+
+    if (EventPipe[0] >= 0)
+    {
+        close(EventPipe[0]);
+        close(EventPipe[1]);
+    }
+}
+
+int LibVirt::LifecycleCallback(virConnectPtr conn, virDomainPtr dom, int event, int detail, void* opaque)
+{
+    LibVirt* Self = (LibVirt*)opaque;
+
+    (void)conn;
+    (void)dom;
+
+    /* Called from the event loop thread */
+    switch (event)
+    {
+        case VIR_DOMAIN_EVENT_STOPPED:
+            __atomic_store_n(&Self->Stopped, 1, __ATOMIC_SEQ_CST);
+            Self->SignalEvent(detail == VIR_DOMAIN_EVENT_STOPPED_CRASHED ? MACHINE_EVENT_CRASHED : MACHINE_EVENT_STOPPED);
+            break;
+
+        case VIR_DOMAIN_EVENT_CRASHED:
+            Self->SignalEvent(MACHINE_EVENT_CRASHED);
+            break;
+    }
+
+    return 0;
+}
+
+void LibVirt::RebootCallback(virConnectPtr conn, virDomainPtr dom, void* opaque)
+{
+    (void)conn;
+    (void)dom;
+
+    ((LibVirt*)opaque)->SignalEvent(MACHINE_EVENT_REBOOTED);
+}
+
+void LibVirt::SignalEvent(int Event)
+{
+    __atomic_fetch_or(&PendingEvents, Event, __ATOMIC_SEQ_CST);
+
+    /* Wake up whoever is polling. If the pipe is full, a wakeup is already pending */
+    if (write(EventPipe[1], "e", 1) < 0 && errno != EAGAIN)
+        SysregPrintf("Failed signaling machine event: %d\n", errno);
+}
+
+void LibVirt::RegisterEvents()
+{
+    if (EventPipe[0] < 0 || !StartEventLoop())
+        return;
+
+    /* Forget about events of any previous instance */
+    ReadEvents();
+    __atomic_store_n(&Stopped, 0, __ATOMIC_SEQ_CST);
+
+    LifecycleCallbackId = virConnectDomainEventRegisterAny(vConn, vDom, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                           VIR_DOMAIN_EVENT_CALLBACK(LifecycleCallback), this, NULL);
+    if (LifecycleCallbackId < 0)
+    {
+        SysregPrintf("Lifecycle events not supported, falling back to polling\n");
+        return;
+    }
+
+    /* Not all drivers report reboots, lifecycle events are enough to go on */
+    RebootCallbackId = virConnectDomainEventRegisterAny(vConn, vDom, VIR_DOMAIN_EVENT_ID_REBOOT,
+                                                        VIR_DOMAIN_EVENT_CALLBACK(RebootCallback), this, NULL);
+}
+
+void LibVirt::DeregisterEvents()
+{
+    if (RebootCallbackId >= 0)
+    {
+        virConnectDomainEventDeregisterAny(vConn, RebootCallbackId);
+        RebootCallbackId = -1;
+    }
+
+    if (LifecycleCallbackId >= 0)
+    {
+        virConnectDomainEventDeregisterAny(vConn, LifecycleCallbackId);
+        LifecycleCallbackId = -1;
+    }
+}
+
+/* Owned by the sampling thread */
+struct ResourceSampler
+{
+    virDomainPtr Dom;
+    int StopFd;
+    unsigned long long CpuTime;
+    virDomainBlockStatsStruct Block;
+};
+
+/* The RPCs block, so they don't run on the event loop, which carries the console and the lifecycle events */
+void* LibVirt::ResourcesThread(void* opaque)
+{
+    ResourceSampler* Sampler = (ResourceSampler*)opaque;
+    struct pollfd fds[] = {
+        { Sampler->StopFd, POLLIN, 0 },
+    };
+    int r;
+
+    for (;;)
+    {
+        r = poll(fds, 1, AppSettings.ResourcesInterval);
+        if (r < 0 && errno == EINTR)
+            continue;
+        /* Asked to stop */
+        if (r != 0)
+            break;
+
+        SampleResources(Sampler);
+    }
+
+    close(Sampler->StopFd);
+    virDomainFree(Sampler->Dom);
+    delete Sampler;
+    return NULL;
+}
+
+void LibVirt::SampleResources(ResourceSampler* Sampler)
+{
+    ResourceSample Sample;
+    virTypedParameterPtr Params;
+    virDomainMemoryStatStruct Memory[VIR_DOMAIN_MEMORY_STAT_NR];
+    virDomainBlockStatsStruct Block;
+    virDomainInfo Info;
+    unsigned long long CpuTime = 0;
+    int Count;
+
+    memset(&Sample, 0, sizeof(Sample));
+
+    /* Summed over all vCPUs, for the drivers without CPU stats the domain info tells the same */
+    Count = virDomainGetCPUStats(Sampler->Dom, NULL, 0, -1, 1, 0);
+    if (Count > 0)
+    {
+        Params = (virTypedParameterPtr)calloc(Count, sizeof(*Params));
+        if (Params && virDomainGetCPUStats(Sampler->Dom, Params, Count, -1, 1, 0) > 0)
+            virTypedParamsGetULLong(Params, Count, "cpu_time", &CpuTime);
+
+        if (Params)
+        {
+            virTypedParamsClear(Params, Count);
+            free(Params);
+        }
+    }
+    else if (virDomainGetInfo(Sampler->Dom, &Info) == 0)
+    {
+        CpuTime = Info.cpuTime;
+    }
+
+    /* The domain is gone already, nothing to record */
+    if (CpuTime == 0)
+        return;
+
+    Sample.CpuTime = (CpuTime >= Sampler->CpuTime ? CpuTime - Sampler->CpuTime : 0);
+    Sampler->CpuTime = CpuTime;
+
+    Count = virDomainMemoryStats(Sampler->Dom, Memory, VIR_DOMAIN_MEMORY_STAT_NR, 0);
+    for (int i = 0; i < Count; i++)
+    {
+        if (Memory[i].tag == VIR_DOMAIN_MEMORY_STAT_RSS)
+            Sample.Rss = Memory[i].val;
+        else if (Memory[i].tag == VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON)
+            Sample.Balloon = Memory[i].val;
+    }
+
+    /* libvirt finds the disk by its source as well */
+    if (AppSettings.HardDiskImage[0] &&
+        virDomainBlockStats(Sampler->Dom, AppSettings.HardDiskImage, &Block, sizeof(Block)) == 0)
+    {
+        if (Block.rd_bytes >= Sampler->Block.rd_bytes && Block.wr_bytes >= Sampler->Block.wr_bytes)
+        {
+            Sample.ReadBytes = Block.rd_bytes - Sampler->Block.rd_bytes;
+            Sample.WriteBytes = Block.wr_bytes - Sampler->Block.wr_bytes;
+            Sample.ReadOps = Block.rd_req - Sampler->Block.rd_req;
+            Sample.WriteOps = Block.wr_req - Sampler->Block.wr_req;
+        }
+
+        Sampler->Block = Block;
+    }
+
+    RecordResources(&Sample);
+}
+
+void LibVirt::StartResources()
+{
+    ResourceSampler* Sampler;
+    int StopPipe[2];
+
+    if (ResourcesPipe >= 0 || !ResourcesActive())
+        return;
+
+    if (pipe2(StopPipe, O_CLOEXEC) < 0)
+    {
+        SysregPrintf("Cannot sample the resources of the domain\n");
+        return;
+    }
+
+    /* The sampler holds a domain of its own, the machine may replace vDom meanwhile */
+    Sampler = new ResourceSampler();
+    Sampler->Dom = vDom;
+    Sampler->StopFd = StopPipe[0];
+    virDomainRef(vDom);
+
+    if (pthread_create(&ResourcesThreadId, NULL, ResourcesThread, Sampler) != 0)
+    {
+        SysregPrintf("Cannot sample the resources of the domain\n");
+        close(StopPipe[0]);
+        close(StopPipe[1]);
+        virDomainFree(Sampler->Dom);
+        delete Sampler;
+        return;
+    }
+
+    ResourcesPipe = StopPipe[1];
+}
+
+void LibVirt::StopResources()
+{
+    char Command = 'q';
+
+    if (ResourcesPipe < 0)
+        return;
+
+    /* Waits for a sample being taken, there is no record after this */
+    if (write(ResourcesPipe, &Command, 1) < 0)
+        SysregPrintf("Cannot stop sampling the resources\n");
+    pthread_join(ResourcesThreadId, NULL);
+
+    close(ResourcesPipe);
+    ResourcesPipe = -1;
+}
+
+/* Until one of the Events is pending, without consuming it */
+bool LibVirt::WaitForEvent(int Events, int timeout)
+{
+    struct pollfd fds[] = {
+        { EventPipe[0], POLLIN, 0 },
+    };
+    unsigned long long Deadline = MetricsNow() + timeout * 1000000ULL;
+    unsigned long long Now;
+    char Drain[16];
+
+    while (!(__atomic_load_n(&PendingEvents, __ATOMIC_SEQ_CST) & Events))
+    {
+        Now = MetricsNow();
+        if (Now >= Deadline)
+            return false;
+
+        poll(fds, (sizeof(fds) / sizeof(struct pollfd)), (int)((Deadline - Now) / 1000000) + 1);
+        while (read(EventPipe[0], Drain, sizeof(Drain)) > 0);
+    }
+
+    return true;
+}
+
+bool LibVirt::WaitForShutoff(int timeout)
+{
+    struct timespec Now, Deadline;
+    virDomainInfo info;
+    int Remaining;
+
+    clock_gettime(CLOCK_MONOTONIC, &Deadline);
+    Deadline.tv_sec += timeout / 1000;
+    Deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (Deadline.tv_nsec >= 1000000000L)
+    {
+        ++Deadline.tv_sec;
+        Deadline.tv_nsec -= 1000000000L;
+    }
+
+    for (;;)
+    {
+        if (__atomic_load_n(&Stopped, __ATOMIC_SEQ_CST))
+            return true;
+
+        /* Without events, the state has to be polled */
+        if (LifecycleCallbackId < 0 && virDomainGetInfo(vDom, &info) == 0 && info.state == VIR_DOMAIN_SHUTOFF)
+            return true;
+
+        clock_gettime(CLOCK_MONOTONIC, &Now);
+        Remaining = (Deadline.tv_sec - Now.tv_sec) * 1000 + (Deadline.tv_nsec - Now.tv_nsec) / 1000000L;
+        if (Remaining <= 0)
+            return false;
+
+        if (LifecycleCallbackId >= 0)
+        {
+            struct pollfd fds[] = {
+                { EventPipe[0], POLLIN, 0 },
+            };
+
+            /* Don't consume the events, the console may still need them */
+            poll(fds, (sizeof(fds) / sizeof(struct pollfd)), Remaining);
+        }
+        else
+        {
+            usleep((Remaining < 100 ? Remaining : 100) * 1000);
+        }
+    }
+}
+
+bool LibVirt::UndefineDomain(virDomainPtr Dom)
+{
+    /* Some drivers refuse undefining while the domain is still being torn down,
+       back off shortly instead of waiting seconds between attempts */
+    for (unsigned int i = 0; i < 240; ++i)
+    {
+        if (virDomainUndefine(Dom) == 0)
+            return true;
+
+        usleep(250000);
+    }
+
+    return false;
 }
 
 bool LibVirt::IsMachineRunning(const char* name, bool destroy)
@@ -40,91 +421,74 @@ bool LibVirt::IsMachineRunning(const char* name, bool destroy)
         Ret = (virDomainDestroy(vDomPtr) != 0);
 
     if (!Ret)
-    {
-        for (unsigned int i = 0; i < 12; ++i)
-        {
-            if (virDomainUndefine(vDomPtr) == 0)
-                break;
-
-            sleep(5);
-        }
-    }
+        UndefineDomain(vDomPtr);
 
     virDomainFree(vDomPtr);
 
     return Ret;
 }
 
-void LibVirt::InitializeDisk()
+bool LibVirt::InitializeDisk()
 {
-    FILE* file;
-    char qemu_img_cmdline[300];
+    char Size[16];
+    const char* Format = "raw";
+    unsigned long long Start = MetricsNow();
+    bool Created;
 
     /* If the HD image already exists, delete it */
-    if ((file = fopen(AppSettings.HardDiskImage, "r")))
-    {
-        fclose(file);
-        remove(AppSettings.HardDiskImage);
-    }
+    unlink(AppSettings.HardDiskImage);
 
     /* Create a new HD image */
-    if (AppSettings.VMType == TYPE_KVM)
-    {
-        sprintf(qemu_img_cmdline, "qemu-img create -f raw %s %dM",
-                AppSettings.HardDiskImage, AppSettings.ImageSize);
-    }
-    else if (AppSettings.VMType == TYPE_VMWARE_PLAYER)
+    if (AppSettings.VMType == TYPE_VMWARE_PLAYER)
+        Format = "vmdk";
+    else if (AppSettings.VMType == TYPE_VIRTUALBOX)
+        Format = "vdi";
+    else if (AppSettings.ImageFormat[0])
     {
-        sprintf(qemu_img_cmdline, "qemu-img create -f vmdk %s %dM",
-                AppSettings.HardDiskImage, AppSettings.ImageSize);
+        /* KVM reads the image in whatever format the domain tells */
+        Format = AppSettings.ImageFormat;
+        SetDomainDiskFormat(Format);
     }
-    else if (AppSettings.VMType == TYPE_VIRTUALBOX)
+
+    /* No need for qemu-img, but for the formats we don't write ourselves */
+    Created = CreateDiskImage(AppSettings.HardDiskImage, Format, (unsigned long long)AppSettings.ImageSize * 1024 * 1024);
+    if (!Created)
     {
-        sprintf(qemu_img_cmdline, "qemu-img create -f vdi %s %dM",
-                AppSettings.HardDiskImage, AppSettings.ImageSize);
+        snprintf(Size, sizeof(Size), "%dM", AppSettings.ImageSize);
+
+        const char* argv[] = { "qemu-img", "create", "-f", Format, AppSettings.HardDiskImage, Size, NULL };
+        int out = ExecuteArgv(argv, AppSettings.CommandTimeout * 1000);
+        if (out != 0)
+        {
+            SysregPrintf("qemu-img failed creating disk image %s (%s): %d\n", AppSettings.HardDiskImage, Format, out);
+            return false;
+        }
     }
 
-    Execute(qemu_img_cmdline);
+    SysregPrintf("Disk image %s (%s, %d MB) prepared %s in %.3f ms\n", AppSettings.HardDiskImage, Format,
+                 AppSettings.ImageSize, (Created ? "in-process" : "by qemu-img"), (MetricsNow() - Start) / 1e6);
+    return true;
 }
 
-bool LibVirt::LaunchMachine(const char* XmlFileName, const char* BootDevice)
+bool LibVirt::DefineMachine(const char* BootDevice)
 {
-    xmlDocPtr xml = NULL;
-    xmlXPathObjectPtr obj = NULL;
-    xmlXPathContextPtr ctxt = NULL;
-    char* buffer;
-    int len = 0;
+    const char* buffer;
 
-    buffer = ReadFile(XmlFileName);
+    /* Rendered from the template loaded with the settings, no parsing involved */
+    MetricsBegin(PHASE_XML_RENDER);
+    buffer = RenderDomainXml(BootDevice);
+    MetricsEnd(PHASE_XML_RENDER);
     if (buffer == NULL)
         return false;
 
-    xml = xmlReadDoc((const xmlChar *) buffer, "domain.xml", NULL,
-                      XML_PARSE_NOENT | XML_PARSE_NONET |
-                      XML_PARSE_NOWARNING);
-    if (!xml)
-        return false;
-
-    ctxt = xmlXPathNewContext(xml);
-    if (!ctxt)
-        return false;
-
-    obj = xmlXPathEval(BAD_CAST "/domain/os/boot", ctxt);
-    if ((obj != NULL) && (obj->type == XPATH_NODESET)
-            && (obj->nodesetval != NULL) && (obj->nodesetval->nodeTab != NULL))
-    {
-        xmlSetProp(obj->nodesetval->nodeTab[0], BAD_CAST"dev", BAD_CAST BootDevice);
-    }
-    if (obj)
-        xmlXPathFreeObject(obj);
-
-    free(buffer);
-    xmlDocDumpMemory(xml, (xmlChar**) &buffer, &len);
-    xmlFreeDoc(xml);
-    xmlXPathFreeContext(ctxt);
-
+    MetricsBegin(PHASE_DEFINE);
     vDom = virDomainDefineXML(vConn, buffer);
-    xmlFree((xmlChar*)buffer);
+    MetricsEnd(PHASE_DEFINE);
+    return (vDom != NULL);
+}
+
+bool LibVirt::StartMachine()
+{
     if (vDom)
     {
         if (!PrepareSerialPort())
@@ -132,8 +496,14 @@ bool LibVirt::LaunchMachine(const char* XmlFileName, const char* BootDevice)
             return false;
         }
 
+        /* Subscribe before starting, so that no event can be missed */
+        RegisterEvents();
+
+        MetricsBegin(PHASE_CREATE);
         if (virDomainCreate(vDom) != 0)
         {
+            MetricsEnd(PHASE_CREATE);
+            DeregisterEvents();
             virDomainUndefine(vDom);
             virDomainFree(vDom);
             vDom = NULL;
@@ -141,12 +511,16 @@ bool LibVirt::LaunchMachine(const char* XmlFileName, const char* BootDevice)
         }
         else
         {
+            MetricsEnd(PHASE_CREATE);
+
             /* workaround a bug in libvirt */
             const char *name = virDomainGetName(vDom);
             char *domname = strdup(name);
             virDomainFree(vDom);
             vDom = virDomainLookupByName(vConn, domname);
             free(domname);
+
+            StartResources();
             return true;
         }
     }
@@ -159,10 +533,29 @@ const char * LibVirt::GetMachineName() const
     return virDomainGetName(vDom);
 }
 
+void LibVirt::CloseConsole()
+{
+    if (Serial)
+    {
+        Serial->Close();
+        ConsoleFd = -1;
+    }
+    else if (ConsoleFd >= 0)
+    {
+        close(ConsoleFd);
+        ConsoleFd = -1;
+    }
+}
+
 void LibVirt::ShutdownMachine()
 {
     virDomainInfo info;
 
+    /* The last samples are the ones of the running machine */
+    StopResources();
+
+    MetricsBegin(PHASE_SHUTDOWN);
+
     /* Get VM info in order to shutdown.
      * NB: In case the VM was properly shutdown by ReactOS,
      * This will display an error in output.
@@ -178,38 +571,99 @@ void LibVirt::ShutdownMachine()
         /* We will first try a graceful shutdown */
         virDomainReboot(vDom, VIR_DOMAIN_REBOOT_ACPI_POWER_BTN);
 
-        sleep(3);
-
-        /* Is the VM shut? */
-        virDomainGetInfo(vDom, &info);
-
-        /* Kill the VM - if running */
-        if (info.state != VIR_DOMAIN_SHUTOFF)
+        /* Kill the VM - if it didn't stop in time */
+        if (!WaitForShutoff(3000))
             virDomainDestroy(vDom);
     }
 
-    for (unsigned int i = 0; i < 12; ++i)
-    {
-        if (virDomainUndefine(vDom) == 0)
-            break;
+    MetricsEnd(PHASE_SHUTDOWN);
 
-        sleep(5);
-    }
+    DeregisterEvents();
+    MetricsBegin(PHASE_UNDEFINE);
+    UndefineDomain(vDom);
+    MetricsEnd(PHASE_UNDEFINE);
     virDomainFree(vDom);
+    vDom = NULL;
 
     CloseSerialPort();
 }
 
+bool LibVirt::ResetMachine()
+{
+    bool Ret;
+    int Events;
+
+    /* A machine that went down has to be started over */
+    if (vDom == NULL || virDomainIsActive(vDom) != 1)
+        return false;
+
+    /* With on_reboot destroy, QEMU runs with -no-reboot and a reset powers the machine off */
+    if (!DomainRestartsOnReboot())
+    {
+        SysregPrintf("The domain doesn't restart on reboot, no warm retry\n");
+        return false;
+    }
+
+    MetricsBegin(PHASE_RESET);
+    Ret = (virDomainReset(vDom, 0) == 0);
+
+    /* The reset comes back as a reboot event from the event loop, it must not end the next stage */
+    if (Ret && RebootCallbackId >= 0)
+        WaitForEvent(MACHINE_EVENT_REBOOTED | MACHINE_EVENT_STOPPED | MACHINE_EVENT_CRASHED, 2000);
+    MetricsEnd(PHASE_RESET);
+
+    /* Whatever the previous boot reported is over, but a machine that went down can't be retried warm */
+    Events = ReadEvents();
+    if (Events & (MACHINE_EVENT_STOPPED | MACHINE_EVENT_CRASHED))
+        Ret = false;
+
+    return Ret;
+}
+
 bool LibVirt::PrepareSerialPort()
 {
-    // Do nothing
-    return true;
+    /* Only if a transport was configured, otherwise the machine knows best */
+    if (AppSettings.SerialType[0] == 0)
+        return true;
+
+    return PrepareTransport(NULL, NULL);
 }
 
 void LibVirt::CloseSerialPort()
 {
-    // Do nothing
-    return;
+    delete Serial;
+    Serial = NULL;
+}
+
+bool LibVirt::PrepareTransport(const char* Type, const char* Address)
+{
+    if (!Serial)
+        Serial = CreateSerialTransport(Type, Address);
+
+    return (Serial && Serial->Prepare());
+}
+
+int LibVirt::OpenTransport()
+{
+    ConsoleFd = (Serial ? Serial->Open(AppSettings.SerialTimeout * 1000) : -1);
+    return ConsoleFd;
+}
+
+int LibVirt::GetConsoleWriteFd() const
+{
+    return (Serial ? Serial->GetWriteFd() : -1);
+}
+
+bool LibVirt::GetCpuTime(unsigned long long* CpuTime) const
+{
+    virDomainInfo Info;
+
+    if (vDom == NULL || virDomainGetInfo(vDom, &Info) < 0)
+        return false;
+
+    /* Summed over all vCPUs */
+    *CpuTime = Info.cpuTime;
+    return true;
 }
 
 bool LibVirt::IsConnected() const
@@ -232,3 +686,24 @@ bool LibVirt::BreakToDebugger() const
     ret = virDomainSendKey(vDom, VIR_KEYCODE_SET_WIN32, 10, &keycodes[0], 2, 0);
     return (ret == 0);
 }
+
+int LibVirt::GetEventFd() const
+{
+    /* Only worth polling if the driver delivers events */
+    if (LifecycleCallbackId < 0)
+        return -1;
+
+    return EventPipe[0];
+}
+
+int LibVirt::ReadEvents()
+{
+    char Drain[16];
+
+    if (EventPipe[0] < 0)
+        return 0;
+
+    while (read(EventPipe[0], Drain, sizeof(Drain)) > 0);
+
+    return __atomic_exchange_n(&PendingEvents, 0, __ATOMIC_SEQ_CST);
+}
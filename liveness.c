@@ -0,0 +1,100 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Telling a silent guest spinning from an idle one by the CPU time it uses
+ */
+
+#include "sysreg.h"
+
+/* While the guest is silent, its CPU time is sampled every interval. The
+ * share of one host CPU it used since the last sample tells what it does:
+ * at least BusyShare percent is spinning, hardly anything is idle, anything
+ * between is progressing (disk I/O, a test waiting on timers...). Only a
+ * guest spinning without a word for SpinTimeout gets broken into early, the
+ * others wait for the normal timeout.
+ */
+
+/* Below that, the guest only handles its timer ticks */
+#define IDLE_SHARE      5
+
+static const char* StateNames[] = {
+    "unknown",
+    "idle",
+    "progressing",
+    "spinning"
+};
+
+static bool Supported;
+static unsigned long long LastCpu;
+static unsigned long long LastSample;
+static unsigned long long SpinStart;
+static int State;
+
+void LivenessBegin(void)
+{
+    unsigned long long Cpu;
+
+    /* Not every machine tells its CPU time */
+    Supported = (AppSettings.LivenessInterval > 0 && GetMachineCpuTime(&Cpu));
+    LivenessReset();
+}
+
+bool LivenessActive(void)
+{
+    return Supported;
+}
+
+/* The guest said something, whatever it did while silent is over */
+void LivenessReset(void)
+{
+    LastSample = 0;
+    SpinStart = 0;
+    State = LIVENESS_UNKNOWN;
+}
+
+int LivenessSample(void)
+{
+    unsigned long long Cpu, Now, Share;
+
+    if (!Supported || !GetMachineCpuTime(&Cpu))
+        return LIVENESS_UNKNOWN;
+
+    Now = MetricsNow();
+
+    /* The first sample of a silence is only where the next one starts from */
+    if (LastSample && Now > LastSample && Cpu >= LastCpu)
+    {
+        Share = (Cpu - LastCpu) * 100 / (Now - LastSample);
+        StatsSet(STAT_GUEST_CPU, Share);
+
+        if (Share >= AppSettings.BusyShare)
+        {
+            if (State != LIVENESS_SPINNING)
+                SpinStart = LastSample;
+            State = LIVENESS_SPINNING;
+        }
+        else
+        {
+            State = (Share < IDLE_SHARE ? LIVENESS_IDLE : LIVENESS_PROGRESSING);
+            SpinStart = 0;
+        }
+    }
+
+    LastCpu = Cpu;
+    LastSample = Now;
+    return State;
+}
+
+/* How long the guest has been spinning, in ms */
+unsigned int LivenessSpinning(void)
+{
+    if (State != LIVENESS_SPINNING || !SpinStart)
+        return 0;
+
+    return (unsigned int)((LastSample - SpinStart) / 1000000);
+}
+
+const char* LivenessName(int Liveness)
+{
+    return StateNames[Liveness];
+}
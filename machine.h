@@ -9,23 +9,48 @@
 #define __MACHINE_H__
 
 #include "sysreg.h"
+#include "transport.h"
 #include <new>
 
+struct ResourceSampler;
+
 class Machine
 {
 public:
     Machine() {};
 
     virtual bool IsMachineRunning(const char * name, bool destroy) = 0;
-    virtual void InitializeDisk() = 0;
+    virtual bool InitializeDisk() = 0;
     virtual bool PrepareSerialPort() = 0;
-    virtual bool LaunchMachine(const char* XmlFileName, const char* BootDevice) = 0;
+    virtual bool DefineMachine(const char* BootDevice) = 0;
+    virtual bool StartMachine() = 0;
     virtual const char * GetMachineName() const = 0;
-    virtual bool GetConsole(char* console) = 0;
+    virtual int OpenConsole() = 0;
+    virtual void CloseConsole() = 0;
     virtual void ShutdownMachine() = 0;
     virtual void CloseSerialPort() = 0;
     virtual bool IsConnected() const = 0;
     virtual bool BreakToDebugger() const = 0;
+    virtual int GetEventFd() const = 0;
+    virtual int ReadEvents() = 0;
+
+    /* Where console writes go, when it's not the console fd itself */
+    virtual int GetConsoleWriteFd() const { return -1; };
+
+    /* Reset the running guest for another try, the console stays open. False when it can't */
+    virtual bool ResetMachine() { return false; };
+
+    /* Human monitor command of the emulator, when it has one */
+    virtual bool MonitorCommand(const char* Command, char* Result, size_t Size) const
+    {
+        (void)Command;
+        (void)Result;
+        (void)Size;
+        return false;
+    };
+
+    /* CPU time the guest used so far in ns, when the machine tells it */
+    virtual bool GetCpuTime(unsigned long long* CpuTime) const { (void)CpuTime; return false; };
 
     virtual ~Machine() {};
 };
@@ -37,18 +62,53 @@ public:
     virtual ~LibVirt();
 
     virtual bool IsMachineRunning(const char * name, bool destroy);
-    virtual void InitializeDisk();
+    virtual bool InitializeDisk();
     virtual bool PrepareSerialPort();
-    virtual bool LaunchMachine(const char* XmlFileName, const char* BootDevice);
+    virtual bool DefineMachine(const char* BootDevice);
+    virtual bool StartMachine();
     virtual const char * GetMachineName() const;
+    virtual void CloseConsole();
     virtual void ShutdownMachine();
     virtual void CloseSerialPort();
     virtual bool IsConnected() const;
     virtual bool BreakToDebugger() const;
+    virtual int GetEventFd() const;
+    virtual int ReadEvents();
+    virtual int GetConsoleWriteFd() const;
+    virtual bool GetCpuTime(unsigned long long* CpuTime) const;
+    virtual bool ResetMachine();
 
 protected:
+    static bool StartEventLoop();
+    bool PrepareTransport(const char* Type, const char* Address);
+    int OpenTransport();
+
     virConnectPtr vConn;
     virDomainPtr vDom;
+    int ConsoleFd;
+    SerialTransport* Serial;
+
+private:
+    static int LifecycleCallback(virConnectPtr conn, virDomainPtr dom, int event, int detail, void* opaque);
+    static void RebootCallback(virConnectPtr conn, virDomainPtr dom, void* opaque);
+    void SignalEvent(int Event);
+    void RegisterEvents();
+    void DeregisterEvents();
+    static void* ResourcesThread(void* opaque);
+    static void SampleResources(ResourceSampler* Sampler);
+    void StartResources();
+    void StopResources();
+    bool WaitForEvent(int Events, int timeout);
+    bool WaitForShutoff(int timeout);
+    static bool UndefineDomain(virDomainPtr Dom);
+
+    int EventPipe[2];
+    int LifecycleCallbackId;
+    int RebootCallbackId;
+    int ResourcesPipe;
+    pthread_t ResourcesThreadId;
+    int PendingEvents;
+    int Stopped;
 };
 
 class KVM : public LibVirt
@@ -56,7 +116,35 @@ class KVM : public LibVirt
 public:
     KVM();
 
-    virtual bool GetConsole(char* console);
+    virtual int OpenConsole();
+    virtual void CloseConsole();
+    virtual bool PrepareSerialPort();
+    virtual bool MonitorCommand(const char* Command, char* Result, size_t Size) const;
+
+private:
+    bool OpenConsoleStream();
+    bool GetConsolePath(char* console);
+    static void StreamCallback(virStreamPtr stream, int events, void* opaque);
+    static void BridgeCallback(int watch, int fd, int events, void* opaque);
+    bool FlushToConsole();
+    void FlushToGuest();
+    void UpdateWatches();
+    void HangUp();
+    void EndBridge();
+
+    bool SocketSerial;
+    virStreamPtr vStream;
+    int Bridge[2];
+    int BridgeWatch;
+    bool StreamWatch;
+    bool Closing;
+    bool Draining;
+    pthread_mutex_t Lock;
+    char ToConsole[4096];
+    size_t ToConsoleLen;
+    size_t ToConsoleOffset;
+    char ToGuest[256];
+    size_t ToGuestLen;
 };
 
 class VMWarePlayer : public LibVirt
@@ -64,9 +152,8 @@ class VMWarePlayer : public LibVirt
 public:
     VMWarePlayer();
 
-    virtual bool GetConsole(char* console);
+    virtual int OpenConsole();
     virtual bool PrepareSerialPort();
-    virtual void CloseSerialPort();
 };
 
 class VirtualBox : public LibVirt
@@ -74,10 +161,43 @@ class VirtualBox : public LibVirt
 public:
     VirtualBox();
 
-    virtual bool GetConsole(char* console);
-    virtual void InitializeDisk();
+    virtual int OpenConsole();
+    virtual bool InitializeDisk();
     virtual bool PrepareSerialPort();
+};
+
+class SimulatedMachine : public Machine
+{
+public:
+    SimulatedMachine();
+    virtual ~SimulatedMachine();
+
+    virtual bool IsMachineRunning(const char * name, bool destroy);
+    virtual bool InitializeDisk();
+    virtual bool PrepareSerialPort();
+    virtual bool DefineMachine(const char* BootDevice);
+    virtual bool StartMachine();
+    virtual const char * GetMachineName() const;
+    virtual int OpenConsole();
+    virtual void CloseConsole();
+    virtual void ShutdownMachine();
     virtual void CloseSerialPort();
+    virtual bool IsConnected() const;
+    virtual bool BreakToDebugger() const;
+    virtual int GetEventFd() const;
+    virtual int ReadEvents();
+    virtual bool GetCpuTime(unsigned long long* CpuTime) const;
+    virtual bool ResetMachine();
+    virtual bool MonitorCommand(const char* Command, char* Result, size_t Size) const;
+
+private:
+    char* Script;
+    char** Lines;
+    unsigned int LineCount;
+    unsigned int NextLine;
+    pid_t Guest;
+    int ConsoleFd;
+    int GuestFd;
 };
 
 #endif
@@ -0,0 +1,343 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Running many configurations from one manifest
+ */
+
+#include "sysreg.h"
+#include <sys/wait.h>
+
+#define MAX_RUNS            256
+#define MAX_GROUPS          32
+
+/* Manifest format:
+ *   <manifest parallel="2" defaults="common.xml" logdir="logs" summary="summary.txt">
+ *     <run name="kvm-256" config="kvm-256.xml" iso="bootcd.iso" />
+ *     ...
+ *   </manifest>
+ * Every run loads the defaults first, its own config then only needs to
+ * contain the settings that differ.
+ *
+ * A run with shards="N" tests="tests.list" (and history="..." to balance
+ * them) is started N times, as <name>.1 to <name>.N, see shard.c.
+ */
+
+typedef struct _Run
+{
+    char Name[64];
+    char Config[255];
+    char Iso[255];
+    pid_t Pid;
+    unsigned int Slot;
+    struct timespec Start;
+    double Duration;
+    int Result;
+    int Group;
+    unsigned int Shard;
+}
+Run;
+
+/* The shards of one run */
+typedef struct _Group
+{
+    char Name[64];
+    char Prefix[200];
+    unsigned int Shards;
+    char Summary[160];
+}
+Group;
+
+static Run Runs[MAX_RUNS];
+static unsigned int RunCount;
+static Group Groups[MAX_GROUPS];
+static unsigned int GroupCount;
+
+static void GetAttribute(xmlNodePtr Node, const char* Name, char* Value, size_t Size)
+{
+    xmlChar* Attr = xmlGetProp(Node, BAD_CAST Name);
+
+    Value[0] = 0;
+    if (Attr)
+    {
+        strncpy(Value, (char*)Attr, Size - 1);
+        Value[Size - 1] = 0;
+        xmlFree(Attr);
+    }
+}
+
+static const char* ResultName(int Result)
+{
+    switch (Result)
+    {
+        case EXIT_CHECKPOINT_REACHED:
+            return "checkpoint";
+
+        case EXIT_CONTINUE:
+            return "failed";
+
+        default:
+            return "aborted";
+    }
+}
+
+/* Lowest slot no running run holds, so that placement gets reused */
+static unsigned int FreeSlot(void)
+{
+    unsigned int Slot, i;
+
+    for (Slot = 0; ; Slot++)
+    {
+        for (i = 0; i < RunCount; i++)
+        {
+            if (Runs[i].Pid > 0 && Runs[i].Slot == Slot)
+                break;
+        }
+
+        if (i == RunCount)
+            return Slot;
+    }
+}
+
+static bool StartRun(Run* Current, const char* Defaults, const char* LogDir)
+{
+    char LogFile[512];
+    int Log;
+
+    snprintf(LogFile, sizeof(LogFile), "%s/%s.log", LogDir, Current->Name);
+    Log = open(LogFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (Log < 0)
+    {
+        SysregPrintf("Cannot create %s\n", LogFile);
+        return false;
+    }
+
+    /* The child takes its part of the tests along */
+    if (Current->Group >= 0)
+    {
+        ShardIndex = Current->Shard;
+        snprintf(ShardListFile, sizeof(ShardListFile), "%s.%u.tests", Groups[Current->Group].Prefix, Current->Shard + 1);
+        snprintf(ShardResultsFile, sizeof(ShardResultsFile), "%s.%u.results", Groups[Current->Group].Prefix, Current->Shard + 1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &Current->Start);
+    Current->Slot = FreeSlot();
+    Current->Pid = SpawnTest(Defaults, Current->Config, (Current->Iso[0] ? Current->Iso : NULL), Log, Current->Slot);
+    close(Log);
+
+    ShardIndex = -1;
+    ShardListFile[0] = 0;
+    ShardResultsFile[0] = 0;
+
+    if (Current->Pid < 0)
+        return false;
+
+    SysregPrintf("Run %s started (pid %d), output in %s\n", Current->Name, Current->Pid, LogFile);
+    return true;
+}
+
+static Run* WaitRun(void)
+{
+    struct timespec End;
+    unsigned int i;
+    int Status;
+    pid_t Pid;
+
+    do
+        Pid = waitpid(-1, &Status, 0);
+    while (Pid < 0 && errno == EINTR);
+
+    if (Pid < 0)
+        return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &End);
+
+    for (i = 0; i < RunCount; i++)
+    {
+        if (Runs[i].Pid != Pid)
+            continue;
+
+        Runs[i].Pid = 0;
+        Runs[i].Duration = (End.tv_sec - Runs[i].Start.tv_sec) + (End.tv_nsec - Runs[i].Start.tv_nsec) / 1e9;
+        Runs[i].Result = (WIFEXITED(Status) ? WEXITSTATUS(Status) : EXIT_DONT_CONTINUE);
+
+        SysregPrintf("Run %s: %s after %.1f seconds\n", Runs[i].Name, ResultName(Runs[i].Result), Runs[i].Duration);
+        return &Runs[i];
+    }
+
+    /* Not one of ours, keep waiting */
+    return WaitRun();
+}
+
+static void PrintSummary(FILE* Out)
+{
+    unsigned int i;
+
+    fprintf(Out, "%-32s %-12s %10s\n", "Run", "Result", "Seconds");
+    for (i = 0; i < RunCount; i++)
+        fprintf(Out, "%-32s %-12s %10.1f\n", Runs[i].Name, ResultName(Runs[i].Result), Runs[i].Duration);
+
+    for (i = 0; i < GroupCount; i++)
+        fprintf(Out, "%s: %s\n", Groups[i].Name, Groups[i].Summary);
+}
+
+/* Adds the shards of a sharded run, with the tests split between them */
+static bool AddShards(const Run* Parsed, xmlNodePtr Node, unsigned int Shards, const char* LogDir)
+{
+    char Tests[255], History[255];
+    Group* Current;
+    unsigned int i;
+    /* The parsed run is in the slot of the first shard */
+    Run Template = *Parsed;
+
+    GetAttribute(Node, "tests", Tests, sizeof(Tests));
+    GetAttribute(Node, "history", History, sizeof(History));
+
+    if (!Tests[0] || GroupCount == MAX_GROUPS || RunCount + Shards > MAX_RUNS)
+    {
+        SysregPrintf("Cannot shard %s, it is run once\n", Template.Name);
+        return false;
+    }
+
+    Current = &Groups[GroupCount];
+    memset(Current, 0, sizeof(Group));
+    strcpy(Current->Name, Template.Name);
+    snprintf(Current->Prefix, sizeof(Current->Prefix), "%.130s/%s", LogDir, Template.Name);
+    Current->Shards = Shards;
+    strcpy(Current->Summary, "not merged");
+
+    if (!SplitShards(Tests, History, Shards, Current->Prefix))
+        return false;
+
+    for (i = 0; i < Shards; i++)
+    {
+        Runs[RunCount] = Template;
+        snprintf(Runs[RunCount].Name, sizeof(Runs[RunCount].Name), "%.52s.%u", Template.Name, i + 1);
+        Runs[RunCount].Group = GroupCount;
+        Runs[RunCount].Shard = i;
+        ++RunCount;
+    }
+
+    ++GroupCount;
+    return true;
+}
+
+int RunManifest(const char* Manifest)
+{
+    xmlDocPtr doc;
+    xmlNodePtr Node;
+    char Defaults[255], LogDir[255], Summary[255], Value[16];
+    unsigned int Parallel, Shards, Running = 0, Next = 0, i;
+    int Ret = EXIT_CHECKPOINT_REACHED;
+    Run* Done;
+
+    doc = xmlReadFile(Manifest, NULL, XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+    if (!doc || !xmlDocGetRootElement(doc) || xmlStrcmp(xmlDocGetRootElement(doc)->name, BAD_CAST "manifest"))
+    {
+        SysregPrintf("Cannot load manifest %s\n", Manifest);
+        if (doc)
+            xmlFreeDoc(doc);
+        return EXIT_DONT_CONTINUE;
+    }
+
+    Node = xmlDocGetRootElement(doc);
+    GetAttribute(Node, "defaults", Defaults, sizeof(Defaults));
+    GetAttribute(Node, "logdir", LogDir, sizeof(LogDir));
+    GetAttribute(Node, "summary", Summary, sizeof(Summary));
+    GetAttribute(Node, "parallel", Value, sizeof(Value));
+
+    if (!LogDir[0])
+        strcpy(LogDir, ".");
+
+    Parallel = atoi(Value);
+    if (Parallel < 1)
+        Parallel = 1;
+
+    RunCount = 0;
+    GroupCount = 0;
+    for (Node = Node->children; Node; Node = Node->next)
+    {
+        if (Node->type != XML_ELEMENT_NODE || xmlStrcmp(Node->name, BAD_CAST "run"))
+            continue;
+
+        if (RunCount == MAX_RUNS)
+        {
+            SysregPrintf("Too many runs, only the first %u are done\n", MAX_RUNS);
+            break;
+        }
+
+        memset(&Runs[RunCount], 0, sizeof(Run));
+        GetAttribute(Node, "name", Runs[RunCount].Name, sizeof(Runs[RunCount].Name));
+        GetAttribute(Node, "config", Runs[RunCount].Config, sizeof(Runs[RunCount].Config));
+        GetAttribute(Node, "iso", Runs[RunCount].Iso, sizeof(Runs[RunCount].Iso));
+        Runs[RunCount].Result = EXIT_DONT_CONTINUE;
+        Runs[RunCount].Group = -1;
+
+        if (!Runs[RunCount].Config[0])
+        {
+            SysregPrintf("Run without config ignored\n");
+            continue;
+        }
+
+        if (!Runs[RunCount].Name[0])
+            snprintf(Runs[RunCount].Name, sizeof(Runs[RunCount].Name), "run%u", RunCount + 1);
+
+        GetAttribute(Node, "shards", Value, sizeof(Value));
+        Shards = atoi(Value);
+        if (Shards > 1 && AddShards(&Runs[RunCount], Node, Shards, LogDir))
+            continue;
+
+        ++RunCount;
+    }
+
+    xmlFreeDoc(doc);
+
+    SysregPrintf("Manifest %s: %u runs, %u at a time\n", Manifest, RunCount, Parallel);
+
+    /* Keep Parallel runs going until all are done */
+    while (Next < RunCount || Running > 0)
+    {
+        while (Next < RunCount && Running < Parallel)
+        {
+            if (StartRun(&Runs[Next], (Defaults[0] ? Defaults : NULL), LogDir))
+                ++Running;
+            ++Next;
+        }
+
+        if (Running == 0)
+            continue;
+
+        Done = WaitRun();
+        if (!Done)
+            break;
+
+        --Running;
+    }
+
+    /* One set of results for all the shards of a run */
+    for (i = 0; i < GroupCount; i++)
+        MergeShards(Groups[i].Prefix, Groups[i].Shards, Groups[i].Summary, sizeof(Groups[i].Summary));
+
+    /* The worst result of all is the one of the manifest */
+    for (i = 0; i < RunCount; i++)
+    {
+        if (Runs[i].Result > Ret)
+            Ret = Runs[i].Result;
+    }
+
+    PrintSummary(stdout);
+
+    if (Summary[0])
+    {
+        FILE* Out = fopen(Summary, "w");
+
+        if (Out)
+        {
+            PrintSummary(Out);
+            fclose(Out);
+        }
+        else
+            SysregPrintf("Cannot write summary %s\n", Summary);
+    }
+
+    return Ret;
+}
@@ -0,0 +1,297 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Per-phase timing and counters, exported as JSON and Prometheus textfile
+ */
+
+#include "sysreg.h"
+
+typedef struct _PhaseMetrics
+{
+    unsigned long long Duration[NUM_PHASES];
+    unsigned long long Counter[NUM_COUNTERS];
+}
+PhaseMetrics;
+
+static const char* PhaseNames[NUM_PHASES] = {
+    "disk_init",
+    "hook",
+    "xml_render",
+    "define",
+    "create",
+    "first_serial_byte",
+    "checkpoint",
+    "kdbg",
+    "shutdown",
+    "undefine",
+    "reset"
+};
+
+static const char* CounterNames[NUM_COUNTERS] = {
+    "bytes",
+    "lines",
+    "retries",
+    "conts",
+    "dropped_lines"
+};
+
+static PhaseMetrics StageMetrics[NUM_STAGES];
+static PhaseMetrics RunMetrics;
+static unsigned long long PhaseStart[NUM_PHASES];
+static unsigned long long RunStart;
+static int CurrentStage = -1;
+
+unsigned long long MetricsNow(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (unsigned long long)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+void MetricsSetStage(int Stage)
+{
+    if (RunStart == 0)
+        RunStart = MetricsNow();
+
+    /* Phases still open belong to the previous stage, drop them */
+    memset(PhaseStart, 0, sizeof(PhaseStart));
+    CurrentStage = Stage;
+    StatsSet(STAT_STAGE, Stage + 1);
+}
+
+void MetricsBegin(int Phase)
+{
+    if (RunStart == 0)
+        RunStart = MetricsNow();
+
+    PhaseStart[Phase] = MetricsNow();
+    ResourcesPhase(Phase, false);
+}
+
+bool MetricsPending(int Phase)
+{
+    return (PhaseStart[Phase] != 0);
+}
+
+void MetricsEnd(int Phase)
+{
+    unsigned long long Elapsed;
+
+    /* Nothing to do if the phase was never started, or already ended */
+    if (PhaseStart[Phase] == 0)
+        return;
+
+    Elapsed = MetricsNow() - PhaseStart[Phase];
+    PhaseStart[Phase] = 0;
+    ResourcesPhase(Phase, true);
+
+    RunMetrics.Duration[Phase] += Elapsed;
+    if (CurrentStage >= 0)
+        StageMetrics[CurrentStage].Duration[Phase] += Elapsed;
+}
+
+/* Time since the run started, in ns */
+unsigned long long MetricsElapsed(void)
+{
+    if (RunStart == 0)
+        return 0;
+
+    return MetricsNow() - RunStart;
+}
+
+const char* MetricsPhaseName(int Phase)
+{
+    return PhaseNames[Phase];
+}
+
+void MetricsCount(int Counter, unsigned long long Value)
+{
+    RunMetrics.Counter[Counter] += Value;
+    if (CurrentStage >= 0)
+        StageMetrics[CurrentStage].Counter[Counter] += Value;
+}
+
+static void WriteJsonMetrics(FILE* File, const PhaseMetrics* Metrics)
+{
+    int i;
+
+    fprintf(File, "\"phases\": {");
+    for (i = 0; i < NUM_PHASES; i++)
+        fprintf(File, "%s\"%s\": %.6f", (i ? ", " : ""), PhaseNames[i], Metrics->Duration[i] / 1e9);
+
+    fprintf(File, "}, \"counters\": {");
+    for (i = 0; i < NUM_COUNTERS; i++)
+        fprintf(File, "%s\"%s\": %llu", (i ? ", " : ""), CounterNames[i], Metrics->Counter[i]);
+    fprintf(File, "}");
+}
+
+/* Backslashes, quotes and newlines in label values are escaped */
+static void EscapeLabel(const char* Value, char* Escaped, size_t Size)
+{
+    size_t Length = 0;
+
+    for (; *Value && Length + 3 < Size; Value++)
+    {
+        if (*Value == '\\' || *Value == '"')
+        {
+            Escaped[Length++] = '\\';
+            Escaped[Length++] = *Value;
+        }
+        else if (*Value == '\n')
+        {
+            Escaped[Length++] = '\\';
+            Escaped[Length++] = 'n';
+        }
+        else
+            Escaped[Length++] = *Value;
+    }
+
+    Escaped[Length] = 0;
+}
+
+/* A JSON string, control characters included */
+static void EscapeJson(const char* Value, char* Escaped, size_t Size)
+{
+    size_t Length = 0;
+
+    for (; *Value && Length + 7 < Size; Value++)
+    {
+        if (*Value == '\\' || *Value == '"')
+        {
+            Escaped[Length++] = '\\';
+            Escaped[Length++] = *Value;
+        }
+        else if ((unsigned char)*Value < 0x20)
+            Length += sprintf(Escaped + Length, "\\u%04x", (unsigned char)*Value);
+        else
+            Escaped[Length++] = *Value;
+    }
+
+    Escaped[Length] = 0;
+}
+
+/* The stages, then the whole run as stage "all" */
+static const PhaseMetrics* GetStageMetrics(int Stage, char* Name, size_t Size)
+{
+    if (Stage == NUM_STAGES)
+    {
+        snprintf(Name, Size, "all");
+        return &RunMetrics;
+    }
+
+    snprintf(Name, Size, "%d", Stage + 1);
+    return &StageMetrics[Stage];
+}
+
+/* All samples of a family go together, right after its type */
+static void WritePrometheusMetrics(FILE* File, const char* Vm)
+{
+    const PhaseMetrics* Metrics;
+    char Stage[8];
+    int i, j;
+
+    fprintf(File, "# TYPE sysreg2_phase_seconds gauge\n");
+    for (i = 0; i < NUM_PHASES; i++)
+    {
+        for (j = 0; j <= NUM_STAGES; j++)
+        {
+            Metrics = GetStageMetrics(j, Stage, sizeof(Stage));
+            fprintf(File, "sysreg2_phase_seconds{vm=\"%s\",stage=\"%s\",phase=\"%s\"} %.6f\n",
+                    Vm, Stage, PhaseNames[i], Metrics->Duration[i] / 1e9);
+        }
+    }
+
+    for (i = 0; i < NUM_COUNTERS; i++)
+    {
+        fprintf(File, "# TYPE sysreg2_%s_total counter\n", CounterNames[i]);
+        for (j = 0; j <= NUM_STAGES; j++)
+        {
+            Metrics = GetStageMetrics(j, Stage, sizeof(Stage));
+            fprintf(File, "sysreg2_%s_total{vm=\"%s\",stage=\"%s\"} %llu\n",
+                    CounterNames[i], Vm, Stage, Metrics->Counter[i]);
+        }
+    }
+}
+
+/* Write to a temporary file first, so that readers never see half a file */
+static FILE* OpenMetricsFile(const char* Path, char* TempPath, size_t Size)
+{
+    snprintf(TempPath, Size, "%s.tmp", Path);
+    return fopen(TempPath, "w");
+}
+
+static bool CloseMetricsFile(FILE* File, const char* Path, const char* TempPath)
+{
+    if (fclose(File) != 0 || rename(TempPath, Path) < 0)
+    {
+        SysregPrintf("Failed writing metrics to %s: %d\n", Path, errno);
+        unlink(TempPath);
+        return false;
+    }
+
+    return true;
+}
+
+bool WriteMetrics(int Result)
+{
+    FILE* File;
+    char TempPath[260];
+    char Vm[sizeof(AppSettings.Name) * 6];
+    char Commit[256];
+    double RunTime = (RunStart ? (MetricsNow() - RunStart) / 1e9 : 0);
+    bool Ret = true;
+    int i;
+
+    if (AppSettings.MetricsJson[0])
+    {
+        File = OpenMetricsFile(AppSettings.MetricsJson, TempPath, sizeof(TempPath));
+        if (File)
+        {
+            EscapeJson(gGitCommit, Commit, sizeof(Commit));
+            EscapeJson(AppSettings.Name, Vm, sizeof(Vm));
+            fprintf(File, "{\"commit\": \"%s\", \"vm\": \"%s\", \"result\": %d, \"seconds\": %.6f,\n",
+                    Commit, Vm, Result, RunTime);
+            fprintf(File, " \"stages\": [");
+            for (i = 0; i < NUM_STAGES; i++)
+            {
+                fprintf(File, "%s\n  {\"stage\": %d, ", (i ? "," : ""), i + 1);
+                WriteJsonMetrics(File, &StageMetrics[i]);
+                fprintf(File, "}");
+            }
+            fprintf(File, "],\n \"run\": {");
+            WriteJsonMetrics(File, &RunMetrics);
+            fprintf(File, "}}\n");
+
+            Ret = CloseMetricsFile(File, AppSettings.MetricsJson, TempPath) && Ret;
+        }
+        else
+        {
+            SysregPrintf("Failed opening %s: %d\n", TempPath, errno);
+            Ret = false;
+        }
+    }
+
+    if (AppSettings.MetricsPrometheus[0])
+    {
+        File = OpenMetricsFile(AppSettings.MetricsPrometheus, TempPath, sizeof(TempPath));
+        if (File)
+        {
+            EscapeLabel(AppSettings.Name, Vm, sizeof(Vm));
+            WritePrometheusMetrics(File, Vm);
+            fprintf(File, "# TYPE sysreg2_run_seconds gauge\n");
+            fprintf(File, "sysreg2_run_seconds{vm=\"%s\"} %.6f\n", Vm, RunTime);
+            fprintf(File, "# TYPE sysreg2_result gauge\n");
+            fprintf(File, "sysreg2_result{vm=\"%s\"} %d\n", Vm, Result);
+
+            Ret = CloseMetricsFile(File, AppSettings.MetricsPrometheus, TempPath) && Ret;
+        }
+        else
+        {
+            SysregPrintf("Failed opening %s: %d\n", TempPath, errno);
+            Ret = false;
+        }
+    }
+
+    return Ret;
+}
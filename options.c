@@ -9,7 +9,10 @@
 
 #include "sysreg.h"
 
-bool LoadSettings(const char* XmlConfig)
+/* Once a configuration was read, further ones only override what they set */
+static bool SettingsLoaded = false;
+
+bool ReadSettings(const char* XmlConfig)
 {
     xmlDocPtr xml = NULL;
     xmlXPathObjectPtr obj = NULL;
@@ -53,28 +56,176 @@ bool LoadSettings(const char* XmlConfig)
     obj = xmlXPathEval(BAD_CAST"string(/settings/general/vm/@type)",ctxt);
     if ((obj != NULL) && (obj->type == XPATH_STRING))
     {
-        if (xmlStrcasecmp(obj->stringval, BAD_CAST"vmwareplayer") == 0)
+        if (xmlStrcasecmp(obj->stringval, BAD_CAST"kvm") == 0)
+            AppSettings.VMType = TYPE_KVM;
+        else if (xmlStrcasecmp(obj->stringval, BAD_CAST"vmwareplayer") == 0)
             AppSettings.VMType = TYPE_VMWARE_PLAYER;
         else if (xmlStrcasecmp(obj->stringval, BAD_CAST"virtualbox") == 0)
             AppSettings.VMType = TYPE_VIRTUALBOX;
+        else if (xmlStrcasecmp(obj->stringval, BAD_CAST"sim") == 0)
+            AppSettings.VMType = TYPE_SIMULATED;
     }
     if (obj)
         xmlXPathFreeObject(obj);
 
-    if (AppSettings.VMType == TYPE_VMWARE_PLAYER || AppSettings.VMType == TYPE_VIRTUALBOX)
+    if (AppSettings.VMType == TYPE_SIMULATED)
+    {
+        obj = xmlXPathEval(BAD_CAST"string(/settings/general/vm/@script)",ctxt);
+        if ((obj != NULL) && (obj->type == XPATH_STRING) && obj->stringval[0] != 0)
+        {
+            strncpy(AppSettings.Specific.Simulated.Script, (char *)obj->stringval, 254);
+        }
+
+        if (obj)
+            xmlXPathFreeObject(obj);
+    }
+
+    /* KVM only uses a socket if asked to, instead of the pty */
+    if (AppSettings.VMType == TYPE_VMWARE_PLAYER || AppSettings.VMType == TYPE_VIRTUALBOX ||
+        AppSettings.VMType == TYPE_KVM)
     {
         obj = xmlXPathEval(BAD_CAST"string(/settings/general/vm/@serial)",ctxt);
         if ((obj != NULL) && (obj->type == XPATH_STRING) && obj->stringval[0] != 0)
         {
-            strcpy(AppSettings.Specific.VMwarePlayer.Path, (char *)obj->stringval);
+            if (AppSettings.VMType == TYPE_KVM)
+                strncpy(AppSettings.Specific.KVM.SerialSocket, (char *)obj->stringval, 254);
+            else
+                strncpy(AppSettings.Specific.VMwarePlayer.Path, (char *)obj->stringval, 254);
         }
 
         if (obj)
             xmlXPathFreeObject(obj);
     }
 
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/serial/@transport)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.SerialType, (char *)obj->stringval, 15);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/serial/@address)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.SerialAddress, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    /* Don't wait forever for a machine that never connects */
+    if (!SettingsLoaded)
+        AppSettings.SerialTimeout = 60;
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/serial/@timeout)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval))
+    {
+        AppSettings.SerialTimeout = (int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/stats/@socket)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.StatsSocket, (char *)obj->stringval, 99);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/shard/@list)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.ShardList, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/shard/@image)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.ShardImage, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/placement/@enabled)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        AppSettings.Placement = (xmlStrcasecmp(obj->stringval, BAD_CAST"yes") == 0);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/tuning/disk/@cache)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.DiskCache, (char *)obj->stringval, 15);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/tuning/disk/@io)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.DiskIo, (char *)obj->stringval, 15);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/tuning/disk/@bus)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.DiskBus, (char *)obj->stringval, 15);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/tuning/disk/@dir)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.ImageDir, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/tuning/memory/@hugepages)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        AppSettings.Hugepages = (xmlStrcasecmp(obj->stringval, BAD_CAST"yes") == 0);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/tuning/vcpu/@count)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval >= 0)
+    {
+        AppSettings.Vcpus = (unsigned int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/tuning/remove/@devices)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.RemoveDevices, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
     obj = xmlXPathEval(BAD_CAST"number(/settings/general/timeout/@ms)",ctxt);
-    if ((obj != NULL) && (obj->type == XPATH_NUMBER))
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && (!SettingsLoaded || !xmlXPathIsNaN(obj->floatval)))
     {
         /* when no value is set - return value is negative
          * which means infinite */
@@ -84,17 +235,232 @@ bool LoadSettings(const char* XmlConfig)
         xmlXPathFreeObject(obj);
 
     /* First set current time, then add timeout value */
-    AppSettings.GlobalTimeout = time(0);
     obj = xmlXPathEval(BAD_CAST"number(/settings/general/globaltimeout/@s)",ctxt);
-    if ((obj != NULL) && (obj->type == XPATH_NUMBER))
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && (!SettingsLoaded || !xmlXPathIsNaN(obj->floatval)))
     {
+        AppSettings.GlobalTimeout = time(0);
         AppSettings.GlobalTimeout += (int)obj->floatval;
     }
     if (obj)
         xmlXPathFreeObject(obj);
 
+    /* Don't let a hung tool stall the whole run */
+    if (!SettingsLoaded)
+        AppSettings.CommandTimeout = 600;
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/commandtimeout/@s)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval))
+    {
+        AppSettings.CommandTimeout = (int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    /* Sample the CPU time of a silent guest every second, spinning is 90% of a CPU */
+    if (!SettingsLoaded)
+    {
+        AppSettings.LivenessInterval = 1000;
+        AppSettings.BusyShare = 90;
+    }
+
+    /* Walk up to 32 frames of a hung guest from the host */
+    if (!SettingsLoaded)
+        AppSettings.BacktraceFrames = 32;
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/hostbacktrace/@frames)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval >= 0)
+    {
+        AppSettings.BacktraceFrames = (unsigned int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/resources/@file)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.ResourcesFile, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    /* A sample of the guest resources every second */
+    if (!SettingsLoaded)
+        AppSettings.ResourcesInterval = 1000;
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/resources/@interval)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval >= 0)
+    {
+        AppSettings.ResourcesInterval = (int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/liveness/@interval)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval >= 0)
+    {
+        AppSettings.LivenessInterval = (int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/liveness/@spin)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval >= 0)
+    {
+        AppSettings.SpinTimeout = (int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/liveness/@busy)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval > 0)
+    {
+        AppSettings.BusyShare = (unsigned int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/metrics/@json)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.MetricsJson, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/metrics/@prometheus)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.MetricsPrometheus, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/seriallog/@file)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.SerialLog, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    if (!SettingsLoaded)
+        AppSettings.SerialLogFrame = 256;
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/seriallog/@frame)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval > 0)
+    {
+        AppSettings.SerialLogFrame = (unsigned int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/adaptivetimeout/@history)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.HistoryFile, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    if (!SettingsLoaded)
+    {
+        AppSettings.TimeoutFactor = 3.0;
+        AppSettings.MinTimeout = 5000;
+        AppSettings.MaxTimeout = 120000;
+    }
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/adaptivetimeout/@factor)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval > 0)
+    {
+        AppSettings.TimeoutFactor = obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/adaptivetimeout/@min)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval))
+    {
+        AppSettings.MinTimeout = (int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/adaptivetimeout/@max)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval))
+    {
+        AppSettings.MaxTimeout = (int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    if (!SettingsLoaded)
+        AppSettings.FloodTail = 64;
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/flood/@bytes)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval >= 0)
+    {
+        AppSettings.FloodBytes = (unsigned int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/flood/@rate)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval >= 0)
+    {
+        AppSettings.FloodRate = (unsigned int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/flood/@tail)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval > 0)
+    {
+        AppSettings.FloodTail = (unsigned int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/flood/@abort)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval) && obj->floatval >= 0)
+    {
+        AppSettings.FloodAbort = (unsigned int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/baseline/@file)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.BaselineFile, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/baseline/@results)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.ResultsFile, (char *)obj->stringval, 254);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
+    /* No budget, never abort */
+    if (!SettingsLoaded)
+        AppSettings.FailureBudget = -1;
+    obj = xmlXPathEval(BAD_CAST"number(/settings/general/baseline/@budget)",ctxt);
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && !xmlXPathIsNaN(obj->floatval))
+    {
+        AppSettings.FailureBudget = (int)obj->floatval;
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
     obj = xmlXPathEval(BAD_CAST"number(/settings/general/maxcachehits/@value)",ctxt);
-    if ((obj != NULL) && (obj->type == XPATH_NUMBER))
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && (!SettingsLoaded || !xmlXPathIsNaN(obj->floatval)))
     {
         AppSettings.MaxCacheHits = (unsigned int)obj->floatval;
     }
@@ -102,15 +468,24 @@ bool LoadSettings(const char* XmlConfig)
         xmlXPathFreeObject(obj);
 
     obj = xmlXPathEval(BAD_CAST"number(/settings/general/maxretries/@value)",ctxt);
-    if ((obj != NULL) && (obj->type == XPATH_NUMBER))
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && (!SettingsLoaded || !xmlXPathIsNaN(obj->floatval)))
     {
         AppSettings.MaxRetries = (unsigned int)obj->floatval;
     }
     if (obj)
         xmlXPathFreeObject(obj);
 
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/maxretries/@warm)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        AppSettings.WarmRetry = (xmlStrcasecmp(obj->stringval, BAD_CAST"yes") == 0);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
     obj = xmlXPathEval(BAD_CAST"number(/settings/general/maxconts/@value)",ctxt);
-    if ((obj != NULL) && (obj->type == XPATH_NUMBER))
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && (!SettingsLoaded || !xmlXPathIsNaN(obj->floatval)))
     {
         AppSettings.MaxConts = (unsigned int)obj->floatval;
     }
@@ -118,7 +493,7 @@ bool LoadSettings(const char* XmlConfig)
         xmlXPathFreeObject(obj);
 
     obj = xmlXPathEval(BAD_CAST"number(/settings/general/hdd/@size)",ctxt);
-    if ((obj != NULL) && (obj->type == XPATH_NUMBER))
+    if ((obj != NULL) && (obj->type == XPATH_NUMBER) && (!SettingsLoaded || !xmlXPathIsNaN(obj->floatval)))
     {
         if (obj->floatval <= 0)
             AppSettings.ImageSize = 512;
@@ -128,6 +503,15 @@ bool LoadSettings(const char* XmlConfig)
     if (obj)
         xmlXPathFreeObject(obj);
 
+    obj = xmlXPathEval(BAD_CAST"string(/settings/general/hdd/@format)",ctxt);
+    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+    {
+        strncpy(AppSettings.ImageFormat, (char *)obj->stringval, 15);
+    }
+    if (obj)
+        xmlXPathFreeObject(obj);
+
     for (Stage = 0; Stage < NUM_STAGES; Stage++)
     {
         strcpy(TempStr, "string(/settings/");
@@ -154,6 +538,20 @@ bool LoadSettings(const char* XmlConfig)
         if (obj)
             xmlXPathFreeObject(obj);
 
+        /* "stage" (default) runs the hook before anything else in the stage,
+           "launch" lets it run along with the stage setup until the VM starts */
+        strcpy(TempStr, "string(/settings/");
+        strcat(TempStr, StageNames[Stage]);
+        strcat(TempStr, "/@hookwhen)");
+        obj = xmlXPathEval((xmlChar*) TempStr,ctxt);
+        if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
+                (obj->stringval != NULL) && (obj->stringval[0] != 0)))
+        {
+            AppSettings.Stage[Stage].HookBeforeLaunch = (xmlStrcasecmp(obj->stringval, BAD_CAST"launch") == 0);
+        }
+        if (obj)
+            xmlXPathFreeObject(obj);
+
         strcpy(TempStr, "string(/settings/");
         strcat(TempStr, StageNames[Stage]);
         strcat(TempStr, "/success/@on)");
@@ -169,26 +567,25 @@ bool LoadSettings(const char* XmlConfig)
     xmlFreeDoc(xml);
     xmlXPathFreeContext(ctxt);
 
-    xml = xmlReadFile(AppSettings.Filename, NULL, 0);
-    if (!xml)
+    SettingsLoaded = true;
+    return true;
+}
+
+bool LoadSettings(const char* XmlConfig)
+{
+    if (!ReadSettings(XmlConfig))
         return false;
-    ctxt = xmlXPathNewContext(xml);
-    if (!ctxt)
-    {
-        xmlFreeDoc(xml);
+
+    /* A simulated machine has no domain definition */
+    if (AppSettings.VMType == TYPE_SIMULATED)
+        return true;
+
+    /* The domain definition is parsed once for the whole session */
+    if (!LoadDomainTemplate(AppSettings.Filename))
         return false;
-    }
 
-    obj = xmlXPathEval(BAD_CAST"string(/domain/devices/disk[@device='disk']/source/@file)",ctxt);
-    if ((obj != NULL) && ((obj->type == XPATH_STRING) &&
-                     (obj->stringval != NULL) && (obj->stringval[0] != 0)))
-    {
-        strncpy(AppSettings.HardDiskImage, (char *)obj->stringval, 254);
-    }
-    if (obj)
-        xmlXPathFreeObject(obj);
+    if (GetDomainDiskImage())
+        strncpy(AppSettings.HardDiskImage, GetDomainDiskImage(), 254);
 
-    xmlFreeDoc(xml);
-    xmlXPathFreeContext(ctxt);
     return true;
 }
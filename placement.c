@@ -0,0 +1,173 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     CPU and NUMA placement of concurrent test machines
+ */
+
+#include "sysreg.h"
+#include <ctype.h>
+#include <sched.h>
+
+#define MAX_NODES           64
+#define MAX_NODE_CPUS       1024
+
+/* Instances go round robin over the NUMA nodes. On its node, each
+ * instance gets one CPU per vCPU, plus one shared by the emulator
+ * threads and our console reader, so that the reader runs next to the
+ * machine it reads from. Memory is bound to the node of the instance.
+ */
+
+typedef struct _Node
+{
+    int Id;
+    unsigned int CpuCount;
+    unsigned short Cpus[MAX_NODE_CPUS];
+}
+Node;
+
+static bool ParseCpuList(const char* List, Node* Target)
+{
+    const char* p = List;
+    char* End;
+    long First, Last, Cpu;
+
+    Target->CpuCount = 0;
+
+    while (*p && *p != '\n')
+    {
+        First = strtol(p, &End, 10);
+        if (End == p)
+            return false;
+
+        Last = First;
+        p = End;
+        if (*p == '-')
+        {
+            Last = strtol(p + 1, &End, 10);
+            p = End;
+        }
+
+        for (Cpu = First; Cpu <= Last && Target->CpuCount < MAX_NODE_CPUS; Cpu++)
+            Target->Cpus[Target->CpuCount++] = (unsigned short)Cpu;
+
+        if (*p == ',')
+            ++p;
+    }
+
+    return (Target->CpuCount > 0);
+}
+
+static bool ReadCpuList(const char* Path, Node* Target)
+{
+    char* List = ReadFile(Path);
+    bool Ret;
+
+    if (!List)
+        return false;
+
+    Ret = ParseCpuList(List, Target);
+    free(List);
+    return Ret;
+}
+
+static int CompareNodes(const void* a, const void* b)
+{
+    return ((const Node*)a)->Id - ((const Node*)b)->Id;
+}
+
+/* Nodes with CPUs from sysfs, or the whole machine as one node */
+static unsigned int ReadTopology(Node* Nodes)
+{
+    DIR* Dir;
+    struct dirent* Entry;
+    char Path[300];
+    unsigned int Count = 0;
+
+    Dir = opendir("/sys/devices/system/node");
+    while (Dir && (Entry = readdir(Dir)) && Count < MAX_NODES)
+    {
+        if (strncmp(Entry->d_name, "node", 4) || !isdigit((unsigned char)Entry->d_name[4]))
+            continue;
+
+        snprintf(Path, sizeof(Path), "/sys/devices/system/node/%s/cpulist", Entry->d_name);
+        Nodes[Count].Id = atoi(Entry->d_name + 4);
+
+        /* Memory only nodes have no CPU to run on */
+        if (ReadCpuList(Path, &Nodes[Count]))
+            ++Count;
+    }
+
+    if (Dir)
+        closedir(Dir);
+
+    if (Count == 0)
+    {
+        Nodes[0].Id = -1;
+        if (!ReadCpuList("/sys/devices/system/cpu/online", &Nodes[0]))
+            return 0;
+
+        return 1;
+    }
+
+    qsort(Nodes, Count, sizeof(Node), CompareNodes);
+    return Count;
+}
+
+bool ApplyPlacement(int Instance)
+{
+    static Node Nodes[MAX_NODES];
+    unsigned int NodeCount, Vcpus, Offset, i;
+    unsigned int VcpuPins[256];
+    unsigned int EmulatorCpu;
+    Node* Target;
+    cpu_set_t Set;
+    char Plan[512];
+    int Length;
+
+    if (!AppSettings.Placement)
+        return true;
+
+    NodeCount = ReadTopology(Nodes);
+    if (NodeCount == 0)
+    {
+        SysregPrintf("Cannot read the CPU topology, no placement\n");
+        return false;
+    }
+
+    Vcpus = GetDomainVcpus();
+    if (Vcpus == 0)
+        Vcpus = 1;
+    if (Vcpus > sizeof(VcpuPins) / sizeof(VcpuPins[0]))
+        Vcpus = sizeof(VcpuPins) / sizeof(VcpuPins[0]);
+
+    /* Instances spread over the nodes first, then over the CPUs of each node */
+    Target = &Nodes[Instance % NodeCount];
+    Offset = (Instance / NodeCount) * (Vcpus + 1);
+
+    for (i = 0; i < Vcpus; i++)
+        VcpuPins[i] = Target->Cpus[(Offset + i) % Target->CpuCount];
+    EmulatorCpu = Target->Cpus[(Offset + Vcpus) % Target->CpuCount];
+
+    if (Offset + Vcpus + 1 > Target->CpuCount)
+        SysregPrintf("Placement: node %d is overcommitted by instance %d\n", Target->Id, Instance);
+
+    /* Memory binding only makes sense with more than one node */
+    if (!SetDomainPlacement(VcpuPins, Vcpus, EmulatorCpu, (NodeCount > 1 ? Target->Id : -1)))
+        SysregPrintf("Placement: the domain template can't take the placement\n");
+
+    /* The console reader, and every thread started from now on */
+    CPU_ZERO(&Set);
+    CPU_SET(EmulatorCpu, &Set);
+    if (sched_setaffinity(0, sizeof(Set), &Set) < 0)
+        SysregPrintf("Placement: cannot pin the console reader: %d\n", errno);
+
+    /* Report the plan, for auditing */
+    Length = snprintf(Plan, sizeof(Plan), "Placement: instance %d on node %d, vCPUs", Instance, Target->Id);
+    for (i = 0; i < Vcpus && Length < (int)sizeof(Plan); i++)
+        Length += snprintf(Plan + Length, sizeof(Plan) - Length, " %u->%u", i, VcpuPins[i]);
+    if (Length < (int)sizeof(Plan))
+        snprintf(Plan + Length, sizeof(Plan) - Length, ", emulator and console reader on %u", EmulatorCpu);
+    SysregPrintf("%s\n", Plan);
+
+    return true;
+}
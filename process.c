@@ -0,0 +1,282 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Running external commands without a shell, with timeouts
+ */
+
+#include "sysreg.h"
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+/* Grace period between SIGTERM and SIGKILL */
+#define KILL_GRACE_MS       2000
+
+/* Background processes whose output is relayed while waiting for others */
+#define MAX_WATCHED         4
+
+extern char** environ;
+
+static Process* Watched[MAX_WATCHED];
+
+static long ElapsedMs(const struct timespec* Start)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (Now.tv_sec - Start->tv_sec) * 1000 + (Now.tv_nsec - Start->tv_nsec) / 1000000L;
+}
+
+static void FlushLine(Process* Proc)
+{
+    if (Proc->LineLength == 0)
+        return;
+
+    Proc->Line[Proc->LineLength] = 0;
+    SysregPrintf("%s%s", Proc->Line, (Proc->Line[Proc->LineLength - 1] == '\n' ? "" : "\n"));
+    Proc->LineLength = 0;
+}
+
+bool StartProcess(Process* Proc, const char* const argv[])
+{
+    posix_spawn_file_actions_t Actions;
+    posix_spawnattr_t Attr;
+    int Pipe[2];
+    int err;
+
+    memset(Proc, 0, sizeof(*Proc));
+    Proc->Pid = -1;
+    Proc->OutFd = -1;
+    Proc->Name = argv[0];
+
+    if (pipe2(Pipe, O_CLOEXEC) < 0)
+    {
+        SysregPrintf("pipe() failed: %d\n", errno);
+        return false;
+    }
+
+    /* Capture both stdout and stderr, stdin is left alone */
+    posix_spawn_file_actions_init(&Actions);
+    posix_spawn_file_actions_adddup2(&Actions, Pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&Actions, Pipe[1], STDERR_FILENO);
+
+    /* Own process group, so that a timeout kills the whole tree */
+    posix_spawnattr_init(&Attr);
+    posix_spawnattr_setflags(&Attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&Attr, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &Proc->Start);
+    err = posix_spawnp(&Proc->Pid, argv[0], &Actions, &Attr, (char* const*)argv, environ);
+
+    posix_spawnattr_destroy(&Attr);
+    posix_spawn_file_actions_destroy(&Actions);
+    close(Pipe[1]);
+
+    if (err != 0)
+    {
+        SysregPrintf("Failed starting %s: %d\n", argv[0], err);
+        close(Pipe[0]);
+        Proc->Pid = -1;
+        return false;
+    }
+
+    Proc->OutFd = Pipe[0];
+    fcntl(Proc->OutFd, F_SETFL, O_NONBLOCK);
+    return true;
+}
+
+bool PumpProcess(Process* Proc)
+{
+    char b[256];
+    ssize_t got;
+    ssize_t i;
+
+    if (Proc->OutFd < 0)
+        return false;
+
+    for (;;)
+    {
+        got = read(Proc->OutFd, b, sizeof(b));
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+
+        /* EOF or error, the output is done */
+        if (got <= 0)
+        {
+            FlushLine(Proc);
+            close(Proc->OutFd);
+            Proc->OutFd = -1;
+            return false;
+        }
+
+        for (i = 0; i < got; i++)
+        {
+            Proc->Line[Proc->LineLength++] = b[i];
+
+            if (b[i] == '\n' || Proc->LineLength == sizeof(Proc->Line) - 1)
+                FlushLine(Proc);
+        }
+    }
+}
+
+void WatchProcess(Process* Proc)
+{
+    unsigned int i;
+
+    for (i = 0; i < MAX_WATCHED; i++)
+    {
+        if (Watched[i] == NULL)
+        {
+            Watched[i] = Proc;
+            return;
+        }
+    }
+}
+
+static void UnwatchProcess(Process* Proc)
+{
+    unsigned int i;
+
+    for (i = 0; i < MAX_WATCHED; i++)
+    {
+        if (Watched[i] == Proc)
+            Watched[i] = NULL;
+    }
+}
+
+static bool ReapProcess(Process* Proc, int Flags)
+{
+    int Status;
+    pid_t r;
+
+    do
+    {
+        r = waitpid(Proc->Pid, &Status, Flags);
+    }
+    while (r < 0 && errno == EINTR);
+
+    if (r == 0)
+        return false;
+
+    if (r < 0)
+        Proc->ExitCode = -1;
+    else if (WIFEXITED(Status))
+        Proc->ExitCode = WEXITSTATUS(Status);
+    else
+        Proc->ExitCode = -1;
+
+    Proc->Done = true;
+    return true;
+}
+
+int WaitProcess(Process* Proc, int timeout)
+{
+    long Elapsed;
+    int Remaining;
+    bool Killed = false;
+    int Signal = 0;
+
+    if (Proc->Pid < 0)
+        return -1;
+
+    UnwatchProcess(Proc);
+
+    for (;;)
+    {
+        /* Once the output is closed, only the exit is left to wait for */
+        if (Proc->OutFd < 0 && ReapProcess(Proc, WNOHANG))
+            break;
+
+        Elapsed = ElapsedMs(&Proc->Start);
+
+        if (timeout > 0 && Elapsed >= timeout)
+        {
+            /* Escalate: SIGTERM first, SIGKILL if it doesn't listen */
+            if (!Signal)
+            {
+                SysregPrintf("%s timed out after %d ms, terminating\n", Proc->Name, timeout);
+                Signal = SIGTERM;
+                kill(-Proc->Pid, Signal);
+                timeout += KILL_GRACE_MS;
+            }
+            else if (Signal == SIGTERM)
+            {
+                Signal = SIGKILL;
+                kill(-Proc->Pid, Signal);
+                /* Nothing survives that, just reap it */
+                timeout = -1;
+            }
+
+            Killed = true;
+            continue;
+        }
+
+        Remaining = (timeout > 0 ? (int)(timeout - Elapsed) : -1);
+
+        {
+            struct pollfd fds[MAX_WATCHED + 1];
+            unsigned int i;
+
+            /* Keep background processes from blocking on a full pipe meanwhile */
+            fds[0].fd = Proc->OutFd;
+            fds[0].events = POLLIN;
+            for (i = 0; i < MAX_WATCHED; i++)
+            {
+                fds[i + 1].fd = (Watched[i] ? Watched[i]->OutFd : -1);
+                fds[i + 1].events = POLLIN;
+            }
+
+            /* Output closed but still running, check back shortly */
+            if (Proc->OutFd < 0)
+                Remaining = ((Remaining >= 0 && Remaining < 10) ? Remaining : 10);
+
+            if (poll(fds, MAX_WATCHED + 1, Remaining) > 0)
+            {
+                if (fds[0].revents)
+                    PumpProcess(Proc);
+
+                for (i = 0; i < MAX_WATCHED; i++)
+                {
+                    if (fds[i + 1].revents && Watched[i])
+                        PumpProcess(Watched[i]);
+                }
+            }
+        }
+    }
+
+    Elapsed = ElapsedMs(&Proc->Start);
+    SysregPrintf("%s exited with %d after %ld.%03ld seconds\n", Proc->Name, Proc->ExitCode,
+                 Elapsed / 1000, Elapsed % 1000);
+
+    return (Killed ? -1 : Proc->ExitCode);
+}
+
+int ExecuteArgv(const char* const argv[], int timeout)
+{
+    Process Proc;
+
+    if (!StartProcess(&Proc, argv))
+        return -1;
+
+    return WaitProcess(&Proc, timeout);
+}
+
+bool StartCommand(Process* Proc, const char * command)
+{
+    const char* argv[] = { "/bin/sh", "-c", command, NULL };
+
+    /* Hook commands are free form, they need the shell */
+    return StartProcess(Proc, argv);
+}
+
+int Execute(const char * command)
+{
+    Process Proc;
+
+    if (!StartCommand(&Proc, command))
+        return -1;
+
+    return WaitProcess(&Proc, AppSettings.CommandTimeout * 1000);
+}
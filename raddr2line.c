@@ -155,6 +155,7 @@ bool ResolveAddressFromFile(char* Buffer, size_t BufferSize, const char* Data)
     if ((ModuleEntry = FindModule(Module)))
     {
         char Command[256];
+        unsigned long long Start = MetricsNow(), Duration;
 
         /* Run raddr2line */
         sprintf(Command, "%s/host-tools/tools/rsym/raddr2line %s %s 2>/dev/null", OutputPath, ModuleEntry->Path, Address);
@@ -182,6 +183,11 @@ bool ResolveAddressFromFile(char* Buffer, size_t BufferSize, const char* Data)
         }
 
         pclose(Process);
+
+        Duration = MetricsNow() - Start;
+        StatsAdd(STAT_RESOLVES, 1);
+        StatsAdd(STAT_RESOLVE_NS, Duration);
+        StatsMax(STAT_RESOLVE_MAX_NS, Duration);
     }
 
     free(Module);
@@ -0,0 +1,95 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Time series of the host resources a guest uses
+ */
+
+#include "sysreg.h"
+
+/* The machine samples its guest every ResourcesInterval ms, from a
+ * thread of its own, and phases are marked as they begin and end, all in
+ * one text file of a line per record. Times are ms since the start of the
+ * run, like the phases of the metrics, and each record tells the number of
+ * console lines and bytes read so far, to find it in the serial log:
+ *
+ *   R <ms> <stage> <line> <bytes> <cpu us> <rss KB> <balloon KB> <rd KB> <wr KB> <rd ops> <wr ops>
+ *   P <ms> <stage> <line> <bytes> <phase> begin|end
+ *
+ * CPU time and disk I/O are what was used since the previous record of the
+ * same domain, memory is what the guest holds at the time of the record.
+ */
+
+static FILE* ResourcesFile;
+static pthread_mutex_t ResourcesLock = PTHREAD_MUTEX_INITIALIZER;
+
+bool OpenResources(void)
+{
+    /* Not asked for */
+    if (!AppSettings.ResourcesFile[0] || AppSettings.ResourcesInterval <= 0)
+        return true;
+
+    ResourcesFile = fopen(AppSettings.ResourcesFile, "w");
+    if (!ResourcesFile)
+    {
+        SysregPrintf("Cannot create resources file %s\n", AppSettings.ResourcesFile);
+        return false;
+    }
+
+    fprintf(ResourcesFile, "# interval %d ms\n", AppSettings.ResourcesInterval);
+    fprintf(ResourcesFile, "# R ms stage line bytes cpu_us rss_kb balloon_kb rd_kb wr_kb rd_ops wr_ops\n");
+    fprintf(ResourcesFile, "# P ms stage line bytes phase begin|end\n");
+    return true;
+}
+
+bool ResourcesActive(void)
+{
+    return (ResourcesFile != NULL);
+}
+
+/* Everything a record starts with, the stage is 0 before the first one */
+static void WriteHeader(char Type)
+{
+    fprintf(ResourcesFile, "%c %llu %llu %llu %llu", Type, MetricsElapsed() / 1000000,
+            StatsGet(STAT_STAGE), StatsGet(STAT_LINES), StatsGet(STAT_BYTES));
+}
+
+void RecordResources(const ResourceSample* Sample)
+{
+    pthread_mutex_lock(&ResourcesLock);
+
+    if (ResourcesFile)
+    {
+        WriteHeader('R');
+        fprintf(ResourcesFile, " %llu %llu %llu %llu %llu %llu %llu\n", Sample->CpuTime / 1000,
+                Sample->Rss, Sample->Balloon, Sample->ReadBytes / 1024, Sample->WriteBytes / 1024,
+                Sample->ReadOps, Sample->WriteOps);
+    }
+
+    pthread_mutex_unlock(&ResourcesLock);
+}
+
+void ResourcesPhase(int Phase, bool End)
+{
+    pthread_mutex_lock(&ResourcesLock);
+
+    if (ResourcesFile)
+    {
+        WriteHeader('P');
+        fprintf(ResourcesFile, " %s %s\n", MetricsPhaseName(Phase), (End ? "end" : "begin"));
+    }
+
+    pthread_mutex_unlock(&ResourcesLock);
+}
+
+void CloseResources(void)
+{
+    pthread_mutex_lock(&ResourcesLock);
+
+    if (ResourcesFile)
+    {
+        fclose(ResourcesFile);
+        ResourcesFile = NULL;
+    }
+
+    pthread_mutex_unlock(&ResourcesLock);
+}
@@ -0,0 +1,267 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Compressed serial log in independent frames, with a seek index
+ */
+
+#include "sysreg.h"
+#include <limits.h>
+#include <zlib.h>
+
+#define CHUNK_SIZE          16384
+
+/* The log is a series of gzip members, so zcat reads it as a whole.
+ * A new member starts with each stage, each test, on entering and leaving
+ * KDBG, and every SerialLogFrame KB of output. <log>.idx gets one line per
+ * member: "<offset> <first line> <stage> <kdbg> <test>", so a member can be
+ * found and inflated on its own.
+ */
+
+static FILE* LogFile;
+static FILE* IndexFile;
+static z_stream Stream;
+static bool InFrame;
+static unsigned long long LineNumber;
+static unsigned long long FrameBytes;
+static int FrameStage;
+static bool FrameKdbg;
+static char FrameTest[128];
+
+static bool Deflate(int Flush)
+{
+    unsigned char Out[CHUNK_SIZE];
+    int Status;
+
+    do
+    {
+        Stream.next_out = Out;
+        Stream.avail_out = sizeof(Out);
+
+        Status = deflate(&Stream, Flush);
+        if (Status == Z_STREAM_ERROR)
+            return false;
+
+        if (fwrite(Out, 1, sizeof(Out) - Stream.avail_out, LogFile) != sizeof(Out) - Stream.avail_out)
+            return false;
+    }
+    while (Stream.avail_out == 0);
+
+    return true;
+}
+
+static void EndFrame(void)
+{
+    if (!InFrame)
+        return;
+
+    if (!Deflate(Z_FINISH))
+        SysregPrintf("Writing the serial log failed\n");
+
+    deflateEnd(&Stream);
+    fflush(LogFile);
+    fflush(IndexFile);
+    InFrame = false;
+}
+
+static bool StartFrame(int Stage, bool Kdbg)
+{
+    memset(&Stream, 0, sizeof(Stream));
+
+    /* 16 + MAX_WBITS gets a gzip header and trailer around each frame */
+    if (deflateInit2(&Stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    fprintf(IndexFile, "%lld %llu %d %d %s\n", (long long)ftello(LogFile), LineNumber + 1, Stage + 1,
+            (Kdbg ? 1 : 0), (FrameTest[0] ? FrameTest : "-"));
+
+    InFrame = true;
+    FrameBytes = 0;
+    FrameStage = Stage;
+    FrameKdbg = Kdbg;
+    return true;
+}
+
+bool OpenSerialLog(void)
+{
+    char IndexName[270];
+
+    /* Not asked for */
+    if (!AppSettings.SerialLog[0])
+        return true;
+
+    snprintf(IndexName, sizeof(IndexName), "%s.idx", AppSettings.SerialLog);
+
+    LogFile = fopen(AppSettings.SerialLog, "wb");
+    IndexFile = fopen(IndexName, "w");
+    if (!LogFile || !IndexFile)
+    {
+        SysregPrintf("Cannot create serial log %s\n", AppSettings.SerialLog);
+        CloseSerialLog();
+        return false;
+    }
+
+    InFrame = false;
+    LineNumber = 0;
+    FrameTest[0] = 0;
+    return true;
+}
+
+void SerialLogLine(int Stage, const char* Line, bool Kdbg)
+{
+    char Test[sizeof(FrameTest)];
+    bool NewTest;
+    size_t Length;
+
+    if (!LogFile)
+        return;
+
+    NewTest = GetTestName(Line, Test, sizeof(Test));
+    if (NewTest || (InFrame && Stage != FrameStage))
+    {
+        strcpy(FrameTest, (NewTest ? Test : ""));
+        EndFrame();
+    }
+
+    if (InFrame && (Kdbg != FrameKdbg || FrameBytes >= AppSettings.SerialLogFrame * 1024ULL))
+        EndFrame();
+
+    if (!InFrame && !StartFrame(Stage, Kdbg))
+    {
+        SysregPrintf("Cannot compress the serial log, it is left incomplete\n");
+        CloseSerialLog();
+        return;
+    }
+
+    Length = strlen(Line);
+    Stream.next_in = (unsigned char*)Line;
+    Stream.avail_in = Length;
+    if (!Deflate(Z_NO_FLUSH))
+        SysregPrintf("Writing the serial log failed\n");
+
+    FrameBytes += Length;
+    ++LineNumber;
+}
+
+void CloseSerialLog(void)
+{
+    if (LogFile)
+    {
+        EndFrame();
+        fclose(LogFile);
+        LogFile = NULL;
+    }
+
+    if (IndexFile)
+    {
+        fclose(IndexFile);
+        IndexFile = NULL;
+    }
+}
+
+/* Inflate the single gzip member at Offset to stdout */
+static bool InflateFrame(FILE* File, long long Offset)
+{
+    unsigned char In[CHUNK_SIZE];
+    unsigned char Out[CHUNK_SIZE];
+    z_stream Inflate;
+    int Status = Z_OK;
+    size_t Read;
+
+    if (fseeko(File, Offset, SEEK_SET) < 0)
+        return false;
+
+    memset(&Inflate, 0, sizeof(Inflate));
+    if (inflateInit2(&Inflate, 16 + MAX_WBITS) != Z_OK)
+        return false;
+
+    while (Status != Z_STREAM_END)
+    {
+        Read = fread(In, 1, sizeof(In), File);
+        if (Read == 0)
+            break;
+
+        Inflate.next_in = In;
+        Inflate.avail_in = Read;
+
+        do
+        {
+            Inflate.next_out = Out;
+            Inflate.avail_out = sizeof(Out);
+
+            Status = inflate(&Inflate, Z_NO_FLUSH);
+            if (Status != Z_OK && Status != Z_STREAM_END)
+            {
+                inflateEnd(&Inflate);
+                return false;
+            }
+
+            fwrite(Out, 1, sizeof(Out) - Inflate.avail_out, stdout);
+        }
+        while (Inflate.avail_out == 0 && Status != Z_STREAM_END);
+    }
+
+    inflateEnd(&Inflate);
+    return (Status == Z_STREAM_END);
+}
+
+/* Selector is a test ("kernel32:file"), a module ("kernel32"), "stage<n>" or "kdbg" */
+bool ExtractSerialLog(const char* Log, const char* Selector)
+{
+    char IndexName[PATH_MAX];
+    char Line[256];
+    char Test[sizeof(FrameTest)];
+    char Stage[16];
+    char* Colon;
+    long long Offset;
+    unsigned long long First;
+    int FrameNo, Kdbg;
+    unsigned int Frames = 0;
+    FILE* File;
+    FILE* Index;
+    bool Match;
+
+    snprintf(IndexName, sizeof(IndexName), "%s.idx", Log);
+
+    File = fopen(Log, "rb");
+    Index = fopen(IndexName, "r");
+    if (!File || !Index)
+    {
+        SysregPrintf("Cannot open %s or its index\n", Log);
+        if (File)
+            fclose(File);
+        if (Index)
+            fclose(Index);
+        return false;
+    }
+
+    while (fgets(Line, sizeof(Line), Index))
+    {
+        if (sscanf(Line, "%lld %llu %d %d %127s", &Offset, &First, &FrameNo, &Kdbg, Test) != 5)
+            continue;
+
+        snprintf(Stage, sizeof(Stage), "stage%d", FrameNo);
+        Colon = strchr(Test, ':');
+
+        Match = !strcmp(Test, Selector) || !strcmp(Stage, Selector) ||
+                (Kdbg && !strcmp(Selector, "kdbg")) ||
+                (Colon && (size_t)(Colon - Test) == strlen(Selector) && !strncmp(Test, Selector, Colon - Test));
+        if (!Match)
+            continue;
+
+        if (!InflateFrame(File, Offset))
+        {
+            SysregPrintf("Frame at offset %lld is damaged\n", Offset);
+            break;
+        }
+
+        ++Frames;
+    }
+
+    fclose(Index);
+    fclose(File);
+
+    if (Frames == 0)
+        SysregPrintf("Nothing matches %s in %s\n", Selector, Log);
+
+    return (Frames != 0);
+}
@@ -0,0 +1,416 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Splitting the tests over several machines running at once
+ */
+
+#include "sysreg.h"
+
+#define MAX_SHARDS          64
+#define SHARD_FILE          "TESTS.TXT"
+
+/* A manifest run with shards="N" and a test list (one test, or a module
+ * for all of its tests, per line) is started N times. The tests are split
+ * so that the shards take about as long according to the history, each
+ * shard gets its part as TESTS.TXT on a floppy the guest runs them from.
+ * The results of all shards are merged when they are done.
+ *
+ * Shard k of a run uses <logdir>/<name>.<k>.tests and .results, the
+ * merged results end up in <logdir>/<name>.results.
+ *
+ * Any run next to others, sharded or not, gets a machine of its own from
+ * the slot it runs in, shards and runs in a slot never overlap.
+ */
+
+typedef struct _ShardTest
+{
+    char Name[128];
+    unsigned int Index;
+    unsigned int Weight;
+}
+ShardTest;
+
+/* Set for the shard a manifest run is about to spawn */
+int ShardIndex = -1;
+char ShardListFile[255];
+char ShardResultsFile[255];
+
+static ShardTest* ReadTestList(const char* Path, unsigned int* Count)
+{
+    FILE* File;
+    ShardTest* Tests = NULL;
+    ShardTest* Grown;
+    unsigned int Size = 0;
+    char Line[256];
+    char Name[128];
+
+    *Count = 0;
+
+    File = fopen(Path, "r");
+    if (!File)
+        return NULL;
+
+    while (fgets(Line, sizeof(Line), File))
+    {
+        if (sscanf(Line, "%127s", Name) != 1 || Name[0] == '#')
+            continue;
+
+        if (*Count == Size)
+        {
+            Size = (Size ? Size * 2 : 256);
+            Grown = (ShardTest*)realloc(Tests, Size * sizeof(ShardTest));
+            if (!Grown)
+                break;
+
+            Tests = Grown;
+        }
+
+        strcpy(Tests[*Count].Name, Name);
+        Tests[*Count].Index = *Count;
+        Tests[*Count].Weight = 0;
+        ++*Count;
+    }
+
+    fclose(File);
+    return Tests;
+}
+
+/* Longest first, in list order otherwise */
+static int CompareWeights(const void* a, const void* b)
+{
+    const ShardTest* x = (const ShardTest*)a;
+    const ShardTest* y = (const ShardTest*)b;
+
+    if (x->Weight != y->Weight)
+        return (x->Weight < y->Weight) - (x->Weight > y->Weight);
+
+    return (x->Index > y->Index) - (x->Index < y->Index);
+}
+
+static int CompareIndexes(const void* a, const void* b)
+{
+    return (int)((const ShardTest*)a)->Index - (int)((const ShardTest*)b)->Index;
+}
+
+/* Writes Prefix.<k>.tests for each shard, the longest test always going to the shard with the least to do */
+bool SplitShards(const char* TestList, const char* History, unsigned int Shards, const char* Prefix)
+{
+    ShardTest* Tests;
+    unsigned int Count, Known = 0, Default, i, k;
+    unsigned long long Total = 0;
+    unsigned long long Load[MAX_SHARDS];
+    unsigned int Assigned[MAX_SHARDS];
+    unsigned int* Shard;
+    char Path[600];
+    FILE* File;
+    bool Ret = true;
+
+    if (Shards < 1 || Shards > MAX_SHARDS)
+    {
+        SysregPrintf("Between 1 and %u shards, not %u\n", MAX_SHARDS, Shards);
+        return false;
+    }
+
+    Tests = ReadTestList(TestList, &Count);
+    if (!Tests || Count == 0)
+    {
+        SysregPrintf("Cannot read the test list %s\n", TestList);
+        free(Tests);
+        return false;
+    }
+
+    /* The durations from the history, only for this */
+    if (History && History[0])
+    {
+        snprintf(AppSettings.HistoryFile, sizeof(AppSettings.HistoryFile), "%s", History);
+        if (LoadHistory())
+        {
+            for (i = 0; i < Count; i++)
+            {
+                Tests[i].Weight = HistoryDuration(Tests[i].Name);
+                if (Tests[i].Weight)
+                {
+                    Total += Tests[i].Weight;
+                    ++Known;
+                }
+            }
+        }
+        FreeHistory();
+        AppSettings.HistoryFile[0] = 0;
+    }
+
+    /* Tests that never ran are taken as average ones */
+    Default = (Known ? (unsigned int)(Total / Known) : 1);
+    for (i = 0; i < Count; i++)
+    {
+        if (!Tests[i].Weight)
+            Tests[i].Weight = Default;
+    }
+
+    Shard = (unsigned int*)malloc(Count * sizeof(unsigned int));
+    if (!Shard)
+    {
+        free(Tests);
+        return false;
+    }
+
+    memset(Load, 0, sizeof(Load));
+    memset(Assigned, 0, sizeof(Assigned));
+    qsort(Tests, Count, sizeof(ShardTest), CompareWeights);
+
+    for (i = 0; i < Count; i++)
+    {
+        unsigned int Least = 0;
+
+        for (k = 1; k < Shards; k++)
+        {
+            if (Load[k] < Load[Least])
+                Least = k;
+        }
+
+        Load[Least] += Tests[i].Weight;
+        ++Assigned[Least];
+        Shard[Tests[i].Index] = Least;
+    }
+
+    /* Each shard runs its tests in the order of the list */
+    qsort(Tests, Count, sizeof(ShardTest), CompareIndexes);
+
+    for (k = 0; k < Shards && Ret; k++)
+    {
+        snprintf(Path, sizeof(Path), "%s.%u.tests", Prefix, k + 1);
+        File = fopen(Path, "w");
+        if (!File)
+        {
+            SysregPrintf("Cannot write %s\n", Path);
+            Ret = false;
+            break;
+        }
+
+        for (i = 0; i < Count; i++)
+        {
+            if (Shard[i] == k)
+                fprintf(File, "%s\n", Tests[i].Name);
+        }
+
+        if (fclose(File) != 0)
+            Ret = false;
+
+        SysregPrintf("Shard %u: %u tests, %.1f minutes expected\n", k + 1, Assigned[k], Load[k] / 60000.0);
+    }
+
+    free(Shard);
+    free(Tests);
+    return Ret;
+}
+
+static void AppendSuffix(char* Value, size_t Size, const char* Separator, int Suffix)
+{
+    size_t Length = strlen(Value);
+
+    if (Value[0])
+        snprintf(Value + Length, Size - Length, "%s%d", Separator, Suffix);
+}
+
+/* Whatever a run writes */
+static void AppendOutputSuffix(int Suffix)
+{
+    AppendSuffix(AppSettings.ResultsFile, sizeof(AppSettings.ResultsFile), ".", Suffix);
+    AppendSuffix(AppSettings.SerialLog, sizeof(AppSettings.SerialLog), ".", Suffix);
+    AppendSuffix(AppSettings.MetricsJson, sizeof(AppSettings.MetricsJson), ".", Suffix);
+    AppendSuffix(AppSettings.MetricsPrometheus, sizeof(AppSettings.MetricsPrometheus), ".", Suffix);
+    AppendSuffix(AppSettings.ResourcesFile, sizeof(AppSettings.ResourcesFile), ".", Suffix);
+}
+
+/* A machine of its own for each instance running next to others: domain, disk and serial port.
+   Instance 0 keeps the names of the settings. The logs of a shard are named after the shard */
+void IsolateInstance(int Instance)
+{
+    if (Instance <= 0)
+        return;
+
+    AppendSuffix(AppSettings.Name, sizeof(AppSettings.Name), "-", Instance);
+    SetDomainName(AppSettings.Name);
+    SetDomainCopy(Instance);
+
+    AppendSuffix(AppSettings.HardDiskImage, sizeof(AppSettings.HardDiskImage), ".", Instance);
+    SetDomainDiskImage(AppSettings.HardDiskImage);
+
+    if (AppSettings.VMType == TYPE_KVM)
+        AppendSuffix(AppSettings.Specific.KVM.SerialSocket, sizeof(AppSettings.Specific.KVM.SerialSocket), ".", Instance);
+    else if (AppSettings.VMType == TYPE_VMWARE_PLAYER || AppSettings.VMType == TYPE_VIRTUALBOX)
+        AppendSuffix(AppSettings.Specific.VMwarePlayer.Path, sizeof(AppSettings.Specific.VMwarePlayer.Path), ".", Instance);
+    if (strncmp(AppSettings.SerialType, "tcp", 3))
+        AppendSuffix(AppSettings.SerialAddress, sizeof(AppSettings.SerialAddress), ".", Instance);
+
+    if (ShardIndex < 0)
+        AppendOutputSuffix(Instance);
+}
+
+/* Floppy with the test list of this run, and logs of its own when it is one of many shards */
+bool ApplyShard(void)
+{
+    const char* List = (ShardListFile[0] ? ShardListFile : AppSettings.ShardList);
+    char Image[sizeof(AppSettings.ShardImage) + 16];
+    char* Data;
+    char* Converted;
+    size_t Length = 0, i;
+    unsigned int Tests = 0;
+    bool Ret;
+
+    if (!List[0])
+        return true;
+
+    if (ShardIndex >= 0)
+    {
+        AppendOutputSuffix(ShardIndex + 1);
+        snprintf(AppSettings.ResultsFile, sizeof(AppSettings.ResultsFile), "%s", ShardResultsFile);
+    }
+
+    if (AppSettings.ShardImage[0])
+        snprintf(Image, sizeof(Image), "%s", AppSettings.ShardImage);
+    else if (AppSettings.HardDiskImage[0])
+        snprintf(Image, sizeof(Image), "%.230s.floppy", AppSettings.HardDiskImage);
+    else
+        snprintf(Image, sizeof(Image), "%.230s.floppy", List);
+    if (InstanceIndex > 0 && AppSettings.ShardImage[0])
+        AppendSuffix(Image, sizeof(Image), ".", InstanceIndex);
+
+    Data = ReadFile(List);
+    if (!Data)
+    {
+        SysregPrintf("Cannot read the test list %s\n", List);
+        return false;
+    }
+
+    /* The guest expects DOS line endings */
+    Converted = (char*)malloc(strlen(Data) * 2 + 1);
+    if (!Converted)
+    {
+        free(Data);
+        return false;
+    }
+
+    for (i = 0; Data[i]; i++)
+    {
+        if (Data[i] == '\n')
+        {
+            Converted[Length++] = '\r';
+            ++Tests;
+        }
+        Converted[Length++] = Data[i];
+    }
+
+    Ret = CreateFloppyImage(Image, SHARD_FILE, Converted, Length);
+    free(Converted);
+    free(Data);
+
+    if (!Ret)
+        return false;
+
+    if (AppSettings.VMType == TYPE_KVM)
+    {
+        if (!SetDomainFloppyImage(Image))
+            SysregPrintf("No devices in the domain, the floppy can't be attached\n");
+    }
+    else if (AppSettings.VMType != TYPE_SIMULATED)
+        SysregPrintf("Only KVM domains get the floppy attached, attach %s yourself\n", Image);
+
+    if (ShardIndex >= 0)
+        SysregPrintf("Shard %d: %u tests from %s on %s\n", ShardIndex + 1, Tests, List, Image);
+    else
+        SysregPrintf("%u tests from %s on %s\n", Tests, List, Image);
+
+    return true;
+}
+
+static const char* NextLine(const char* Line)
+{
+    const char* End = strchr(Line, '\n');
+
+    return (End ? End + 1 : NULL);
+}
+
+/* A listed test ran if it has results, or if any test of a listed module has */
+static bool ListedTestRan(const char* Listed, const char* Results)
+{
+    size_t Length = strlen(Listed);
+    const char* Entry;
+
+    for (Entry = Results; Entry && *Entry; Entry = NextLine(Entry))
+    {
+        if (!strncmp(Entry, Listed, Length) && (Entry[Length] == ' ' || Entry[Length] == ':'))
+            return true;
+    }
+
+    return false;
+}
+
+/* Merges the results of all the shards into Prefix.results, and sums them up */
+bool MergeShards(const char* Prefix, unsigned int Shards, char* Summary, size_t Size)
+{
+    char Path[600];
+    char TempPath[610];
+    char Line[256];
+    char Name[128];
+    char* Results;
+    const char* Entry;
+    FILE* Merged;
+    FILE* File;
+    unsigned int Executed, Failures, k;
+    unsigned int Ran = 0, TotalExecuted = 0, TotalFailures = 0, NotRun = 0;
+    bool Ret = true;
+
+    snprintf(Path, sizeof(Path), "%s.results", Prefix);
+    snprintf(TempPath, sizeof(TempPath), "%s.tmp", Path);
+    Merged = fopen(TempPath, "w");
+    if (!Merged)
+    {
+        SysregPrintf("Failed opening %s: %d\n", TempPath, errno);
+        return false;
+    }
+
+    for (k = 1; k <= Shards; k++)
+    {
+        /* A shard that died early has no results, all its tests count as not run */
+        snprintf(Path, sizeof(Path), "%s.%u.results", Prefix, k);
+        Results = ReadFile(Path);
+
+        if (Results)
+            fputs(Results, Merged);
+
+        for (Entry = Results; Entry && *Entry; Entry = NextLine(Entry))
+        {
+            if (sscanf(Entry, "%127s %u %u", Name, &Executed, &Failures) != 3)
+                continue;
+
+            ++Ran;
+            TotalExecuted += Executed;
+            TotalFailures += Failures;
+        }
+
+        snprintf(Path, sizeof(Path), "%s.%u.tests", Prefix, k);
+        File = fopen(Path, "r");
+        while (File && fgets(Line, sizeof(Line), File))
+        {
+            if (sscanf(Line, "%127s", Name) == 1 && Name[0] != '#' && !ListedTestRan(Name, Results))
+                ++NotRun;
+        }
+        if (File)
+            fclose(File);
+
+        free(Results);
+    }
+
+    snprintf(Path, sizeof(Path), "%s.results", Prefix);
+    if (fclose(Merged) != 0 || rename(TempPath, Path) < 0)
+    {
+        SysregPrintf("Failed writing results to %s: %d\n", Path, errno);
+        unlink(TempPath);
+        Ret = false;
+    }
+
+    snprintf(Summary, Size, "%u shards: %u tests run, %u executed, %u failures, %u listed not run",
+             Shards, Ran, TotalExecuted, TotalFailures, NotRun);
+    return Ret;
+}
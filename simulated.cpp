@@ -0,0 +1,560 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Simulated machine playing back a scripted guest, no hypervisor needed
+ */
+
+#include "machine.h"
+#include <signal.h>
+#include <sys/wait.h>
+
+/* Script format, one directive per line, '#' starts a comment:
+ *   print <text>       output a line
+ *   repeat <n> <text>  output the same line n times
+ *   flood <n> <text>   output n different lines, the text followed by a counter
+ *   sleep <ms>         stay silent for a while
+ *   autotest <ms>      run each test of the shard list for a while, like rosautotest
+ *   kdbg               enter KDBG: answer "bt" with a backtrace, leave on "cont"
+ *   hang               stay silent forever (until broken into KDBG)
+ *   hang cli           stay silent forever, with interrupts off: breaking in doesn't work
+ *   spin <ms>          stay silent burning the CPU for a while, forever if negative
+ *   reboot             end of this boot, next launch plays what follows
+ * Running off the end of the script powers the machine off.
+ * The monitor shows the guest at EIP 80412345, three frames deep, stop and
+ * cont stop and resume the guest.
+ * simulated.script with simulated.xml is a sample run, "make simcheck" plays it.
+ */
+
+#define SIM_STACK           0xf7a1c000ULL
+#define SIM_EIP             0x80412345ULL
+
+static volatile sig_atomic_t BreakIn = 0;
+
+static void BreakInHandler(int Signal)
+{
+    (void)Signal;
+    BreakIn = 1;
+}
+
+static bool SendGuest(int fd, const char* Data, size_t Length)
+{
+    while (Length > 0)
+    {
+        ssize_t r = write(fd, Data, Length);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+
+        Data += r;
+        Length -= r;
+    }
+
+    return true;
+}
+
+static bool SendGuestLine(int fd, const char* Line)
+{
+    return SendGuest(fd, Line, strlen(Line)) && SendGuest(fd, "\n", 1);
+}
+
+/* Wait for a command typed at the KDBG prompt, terminated with \r */
+static bool ReadCommand(int fd, char* Command, size_t Size)
+{
+    size_t Length = 0;
+    char c;
+
+    for (;;)
+    {
+        ssize_t r = read(fd, &c, 1);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+
+        if (c == '\r' || c == '\n')
+            break;
+
+        if (Length < Size - 1)
+            Command[Length++] = c;
+    }
+
+    Command[Length] = 0;
+    return true;
+}
+
+static bool PlayKdbg(int fd)
+{
+    char Command[64];
+    unsigned int i;
+
+    BreakIn = 0;
+
+    for (;;)
+    {
+        if (!SendGuest(fd, "kdb:> ", 6) || !ReadCommand(fd, Command, sizeof(Command)))
+            return false;
+
+        if (!strcmp(Command, "bt"))
+        {
+            char Frame[64];
+
+            for (i = 0; i < 4; i++)
+            {
+                snprintf(Frame, sizeof(Frame), "<ntoskrnl.exe:%x>", 0x1a2b3 + i * 0x100);
+                if (!SendGuestLine(fd, Frame))
+                    return false;
+            }
+        }
+        /* Leaving KDBG, "o" answers a DbgPrompt */
+        else if (!strcmp(Command, "cont") || !strcmp(Command, "o"))
+        {
+            return true;
+        }
+    }
+}
+
+/* Silent for Duration ms (forever if negative), unless broken into */
+static bool PlaySilence(int fd, int Duration)
+{
+    struct timespec Request, Remaining;
+
+    Request.tv_sec = Duration / 1000;
+    Request.tv_nsec = (Duration % 1000) * 1000000L;
+
+    for (;;)
+    {
+        if (BreakIn && !PlayKdbg(fd))
+            return false;
+
+        if (Duration < 0)
+        {
+            pause();
+            continue;
+        }
+
+        if (nanosleep(&Request, &Remaining) == 0)
+            return true;
+
+        Request = Remaining;
+    }
+}
+
+/* What the guest does with the test list on its floppy */
+static bool PlayAutotest(int fd, int Duration)
+{
+    const char* ListFile = (ShardListFile[0] ? ShardListFile : AppSettings.ShardList);
+    char Line[256], Name[128], Output[400];
+    char* Test;
+    FILE* List;
+    bool Ret = true;
+
+    List = fopen(ListFile, "r");
+    while (List && Ret && fgets(Line, sizeof(Line), List))
+    {
+        if (sscanf(Line, "%127s", Name) != 1)
+            continue;
+
+        /* A module alone stands for all of its tests */
+        Test = strchr(Name, ':');
+        if (Test)
+            *Test++ = 0;
+        else
+            Test = (char*)"all";
+
+        snprintf(Output, sizeof(Output), "Running Wine Test, Module: %s, Test: %s", Name, Test);
+        Ret = SendGuestLine(fd, Output) && PlaySilence(fd, Duration);
+
+        snprintf(Output, sizeof(Output), "%04x:%s: 10 tests executed (0 marked as todo, 0 failures), 0 skipped.", (int)getpid() & 0xffff, Test);
+        Ret = Ret && SendGuestLine(fd, Output);
+    }
+
+    if (List)
+        fclose(List);
+
+    return Ret;
+}
+
+/* Busy and silent for Duration ms (forever if negative), unless broken into */
+static bool PlaySpin(int fd, int Duration)
+{
+    struct timespec Start, Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+
+    for (;;)
+    {
+        if (BreakIn && !PlayKdbg(fd))
+            return false;
+
+        clock_gettime(CLOCK_MONOTONIC, &Now);
+        if (Duration >= 0 && (Now.tv_sec - Start.tv_sec) * 1000 + (Now.tv_nsec - Start.tv_nsec) / 1000000 >= Duration)
+            return true;
+    }
+}
+
+static void PlayBoot(int fd, char** Lines, unsigned int First, unsigned int Count)
+{
+    unsigned int i;
+    int n;
+    sigset_t Signals;
+
+    /* Break-ins were held back until we're able to handle them */
+    signal(SIGUSR1, BreakInHandler);
+    signal(SIGPIPE, SIG_IGN);
+    sigemptyset(&Signals);
+    sigaddset(&Signals, SIGUSR1);
+    sigprocmask(SIG_UNBLOCK, &Signals, NULL);
+
+    for (i = First; i < Count; i++)
+    {
+        char* Line = Lines[i];
+        char* Argument = strchr(Line, ' ');
+
+        Argument = (Argument ? Argument + 1 : Line + strlen(Line));
+
+        if (BreakIn && !PlayKdbg(fd))
+            break;
+
+        if (!strncmp(Line, "print ", 6))
+        {
+            if (!SendGuestLine(fd, Argument))
+                break;
+        }
+        else if (!strncmp(Line, "repeat ", 7))
+        {
+            char* Text = strchr(Argument, ' ');
+
+            for (n = atoi(Argument); Text && n > 0; n--)
+            {
+                if (!SendGuestLine(fd, Text + 1))
+                    goto done;
+            }
+        }
+        else if (!strncmp(Line, "flood ", 6))
+        {
+            char* Text = strchr(Argument, ' ');
+            char Numbered[300];
+
+            for (n = 0; Text && n < atoi(Argument); n++)
+            {
+                snprintf(Numbered, sizeof(Numbered), "%.250s %x", Text + 1, n);
+                if (!SendGuestLine(fd, Numbered))
+                    goto done;
+            }
+        }
+        else if (!strncmp(Line, "sleep ", 6))
+        {
+            if (!PlaySilence(fd, atoi(Argument)))
+                break;
+        }
+        else if (!strncmp(Line, "autotest ", 9))
+        {
+            if (!PlayAutotest(fd, atoi(Argument)))
+                break;
+        }
+        else if (!strcmp(Line, "kdbg"))
+        {
+            if (!PlayKdbg(fd))
+                break;
+        }
+        else if (!strncmp(Line, "spin ", 5))
+        {
+            if (!PlaySpin(fd, atoi(Argument)))
+                break;
+        }
+        else if (!strcmp(Line, "hang cli"))
+        {
+            sigprocmask(SIG_BLOCK, &Signals, NULL);
+            PlaySilence(fd, -1);
+            break;
+        }
+        else if (!strcmp(Line, "hang"))
+        {
+            PlaySilence(fd, -1);
+            break;
+        }
+        else if (!strcmp(Line, "reboot"))
+        {
+            break;
+        }
+    }
+
+done:
+    _exit(0);
+}
+
+SimulatedMachine::SimulatedMachine()
+{
+    char* Line;
+    char* Next;
+
+    Script = ReadFile(AppSettings.Specific.Simulated.Script);
+    Lines = NULL;
+    LineCount = 0;
+    NextLine = 0;
+    Guest = -1;
+    ConsoleFd = -1;
+    GuestFd = -1;
+
+    if (!Script)
+    {
+        SysregPrintf("Cannot read simulation script %s\n", AppSettings.Specific.Simulated.Script);
+        return;
+    }
+
+    /* Split the script into directives, once */
+    Lines = (char**)malloc((strlen(Script) / 2 + 1) * sizeof(char*));
+    for (Line = Script; Line && *Line; Line = Next)
+    {
+        Next = strchr(Line, '\n');
+        if (Next)
+            *Next++ = 0;
+
+        while (*Line == ' ' || *Line == '\t')
+            ++Line;
+
+        if (*Line && *Line != '#')
+            Lines[LineCount++] = Line;
+    }
+}
+
+SimulatedMachine::~SimulatedMachine()
+{
+    ShutdownMachine();
+    free(Lines);
+    free(Script);
+}
+
+bool SimulatedMachine::IsMachineRunning(const char* name, bool destroy)
+{
+    (void)name;
+    (void)destroy;
+
+    return false;
+}
+
+bool SimulatedMachine::InitializeDisk()
+{
+    // Do nothing
+    return true;
+}
+
+bool SimulatedMachine::PrepareSerialPort()
+{
+    int Pair[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, Pair) < 0)
+        return false;
+
+    ConsoleFd = Pair[0];
+    GuestFd = Pair[1];
+    return true;
+}
+
+bool SimulatedMachine::DefineMachine(const char* BootDevice)
+{
+    (void)BootDevice;
+
+    return (Script != NULL);
+}
+
+bool SimulatedMachine::StartMachine()
+{
+    unsigned int First = NextLine;
+    sigset_t Signals, OldSignals;
+
+    if (!PrepareSerialPort())
+        return false;
+
+    /* The following launch picks up after the next reboot */
+    while (NextLine < LineCount && strcmp(Lines[NextLine], "reboot"))
+        ++NextLine;
+    if (NextLine < LineCount)
+        ++NextLine;
+
+    sigemptyset(&Signals);
+    sigaddset(&Signals, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &Signals, &OldSignals);
+
+    Guest = fork();
+    if (Guest == 0)
+    {
+        close(ConsoleFd);
+        PlayBoot(GuestFd, Lines, First, NextLine);
+    }
+
+    sigprocmask(SIG_SETMASK, &OldSignals, NULL);
+
+    if (Guest < 0)
+    {
+        CloseSerialPort();
+        return false;
+    }
+
+    close(GuestFd);
+    GuestFd = -1;
+    return true;
+}
+
+bool SimulatedMachine::ResetMachine()
+{
+    int Console = ConsoleFd;
+
+    /* Like a domain that went down, a guest that exited is started over */
+    if (Guest <= 0 || waitpid(Guest, NULL, WNOHANG) != 0)
+    {
+        Guest = -1;
+        return false;
+    }
+
+    kill(Guest, SIGKILL);
+    waitpid(Guest, NULL, 0);
+    Guest = -1;
+
+    /* A new guest, behind the same console fd */
+    ConsoleFd = -1;
+    if (!StartMachine())
+    {
+        ConsoleFd = Console;
+        return false;
+    }
+
+    if (dup3(ConsoleFd, Console, O_CLOEXEC) < 0 || fcntl(Console, F_SETFL, O_NONBLOCK) < 0)
+    {
+        close(Console);
+        return false;
+    }
+
+    close(ConsoleFd);
+    ConsoleFd = Console;
+    return true;
+}
+
+const char* SimulatedMachine::GetMachineName() const
+{
+    return (AppSettings.Name[0] ? AppSettings.Name : "simulated");
+}
+
+int SimulatedMachine::OpenConsole()
+{
+    if (ConsoleFd < 0 || fcntl(ConsoleFd, F_SETFL, O_NONBLOCK) < 0)
+        return -1;
+
+    return ConsoleFd;
+}
+
+void SimulatedMachine::CloseConsole()
+{
+    CloseSerialPort();
+}
+
+void SimulatedMachine::ShutdownMachine()
+{
+    if (Guest > 0)
+    {
+        kill(Guest, SIGKILL);
+        waitpid(Guest, NULL, 0);
+        Guest = -1;
+    }
+
+    CloseSerialPort();
+}
+
+void SimulatedMachine::CloseSerialPort()
+{
+    if (ConsoleFd >= 0)
+    {
+        close(ConsoleFd);
+        ConsoleFd = -1;
+    }
+
+    if (GuestFd >= 0)
+    {
+        close(GuestFd);
+        GuestFd = -1;
+    }
+}
+
+bool SimulatedMachine::IsConnected() const
+{
+    return (Script != NULL);
+}
+
+bool SimulatedMachine::BreakToDebugger() const
+{
+    if (Guest <= 0)
+        return false;
+
+    return (kill(Guest, SIGUSR1) == 0);
+}
+
+bool SimulatedMachine::GetCpuTime(unsigned long long* CpuTime) const
+{
+    clockid_t Clock;
+    struct timespec Time;
+
+    if (Guest <= 0 || clock_getcpuclockid(Guest, &Clock) != 0 || clock_gettime(Clock, &Time) != 0)
+        return false;
+
+    *CpuTime = (unsigned long long)Time.tv_sec * 1000000000ULL + Time.tv_nsec;
+    return true;
+}
+
+bool SimulatedMachine::MonitorCommand(const char* Command, char* Result, size_t Size) const
+{
+    unsigned long long Address, Depth;
+
+    if (Guest <= 0)
+        return false;
+
+    /* The guest process stands for the vCPU */
+    if (!strcmp(Command, "info status"))
+    {
+        snprintf(Result, Size, "VM status: running\n");
+        return true;
+    }
+
+    if (!strcmp(Command, "stop") || !strcmp(Command, "cont"))
+    {
+        Result[0] = 0;
+        return (kill(Guest, (Command[0] == 's' ? SIGSTOP : SIGCONT)) == 0);
+    }
+
+    if (!strcmp(Command, "info registers"))
+    {
+        snprintf(Result, Size,
+                 "EAX=00000000 EBX=00000000 ECX=00000000 EDX=00000000\n"
+                 "ESI=00000000 EDI=00000000 EBP=%08llx ESP=%08llx\n"
+                 "EIP=%08llx EFL=00000046 [---Z-P-] CPL=0 II=0 A20=1 SMM=0 HLT=0\n",
+                 SIM_STACK, SIM_STACK - 0x20, SIM_EIP);
+        return true;
+    }
+
+    /* Each frame links to the next one 0x40 bytes up, the third one ends the chain */
+    if (sscanf(Command, "x /2wx %llx", &Address) == 1)
+    {
+        Depth = (Address - SIM_STACK) / 0x40 + 1;
+        if (Address < SIM_STACK || Depth >= 3)
+            snprintf(Result, Size, "%016llx: 0x00000000 0x00000000\n", Address);
+        else
+            snprintf(Result, Size, "%016llx: 0x%08llx 0x%08llx\n", Address, Address + 0x40, SIM_EIP + Depth * 0x11111);
+        return true;
+    }
+
+    snprintf(Result, Size, "unknown command: '%s'\n", Command);
+    return true;
+}
+
+int SimulatedMachine::GetEventFd() const
+{
+    /* The guest going away is seen on the console */
+    return -1;
+}
+
+int SimulatedMachine::ReadEvents()
+{
+    return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Live counters of a running test
+ */
+
+#include "sysreg.h"
+#include <signal.h>
+#include <stdint.h>
+
+/* The console loop and the resolver only ever do relaxed atomic updates,
+ * a snapshot is taken by a thread of its own, so neither a SIGUSR1 nor a
+ * client of the stats socket holds up the serial processing. The signal
+ * handler only wakes that thread up through a pipe.
+ */
+
+static const char* StatNames[NUM_STATS] = {
+    "stage",
+    "bytes_read",
+    "read_calls",
+    "poll_calls",
+    "write_calls",
+    "lines",
+    "kdbg_hits",
+    "conts",
+    "cache_hits",
+    "dropped_lines",
+    "resolves",
+    "resolve_ns_total",
+    "resolve_ns_max",
+    "last_line_ns",
+    "guest_cpu_percent"
+};
+
+static unsigned long long Stats[NUM_STATS];
+static char StatsSocket[108];
+static int WakeupPipe[2] = { -1, -1 };
+static bool StatsStarted = false;
+
+void StatsAdd(int Stat, unsigned long long Value)
+{
+    __atomic_fetch_add(&Stats[Stat], Value, __ATOMIC_RELAXED);
+}
+
+void StatsSet(int Stat, unsigned long long Value)
+{
+    __atomic_store_n(&Stats[Stat], Value, __ATOMIC_RELAXED);
+}
+
+void StatsMax(int Stat, unsigned long long Value)
+{
+    unsigned long long Current = __atomic_load_n(&Stats[Stat], __ATOMIC_RELAXED);
+
+    while (Value > Current &&
+           !__atomic_compare_exchange_n(&Stats[Stat], &Current, Value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+unsigned long long StatsGet(int Stat)
+{
+    return __atomic_load_n(&Stats[Stat], __ATOMIC_RELAXED);
+}
+
+/* One "name value" line per counter, and a few derived from them */
+static size_t FormatStats(char* Buffer, size_t Size)
+{
+    unsigned long long Snapshot[NUM_STATS];
+    unsigned long long Now = MetricsNow();
+    size_t Length;
+    int i;
+
+    for (i = 0; i < NUM_STATS; i++)
+        Snapshot[i] = __atomic_load_n(&Stats[i], __ATOMIC_RELAXED);
+
+    Length = snprintf(Buffer, Size, "pid %d\n", (int)getpid());
+    for (i = 0; i < NUM_STATS && Length < Size; i++)
+    {
+        if (i != STAT_LAST_LINE)
+            Length += snprintf(Buffer + Length, Size - Length, "%s %llu\n", StatNames[i], Snapshot[i]);
+    }
+
+    if (Length < Size)
+        Length += snprintf(Buffer + Length, Size - Length, "resolve_ms_avg %.3f\n",
+                           (Snapshot[STAT_RESOLVES] ? Snapshot[STAT_RESOLVE_NS] / 1e6 / Snapshot[STAT_RESOLVES] : 0.0));
+
+    /* Nothing read yet, nothing to be silent about */
+    if (Length < Size && Snapshot[STAT_LAST_LINE])
+        Length += snprintf(Buffer + Length, Size - Length, "since_last_line_ms %llu\n",
+                           (Now > Snapshot[STAT_LAST_LINE] ? (Now - Snapshot[STAT_LAST_LINE]) / 1000000 : 0));
+
+    return (Length < Size ? Length : Size - 1);
+}
+
+static void WriteAll(int fd, const char* Data, size_t Length)
+{
+    ssize_t r;
+
+    while (Length > 0)
+    {
+        r = write(fd, Data, Length);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return;
+
+        Data += r;
+        Length -= r;
+    }
+}
+
+static void DumpSignal(int Signal)
+{
+    int SavedErrno = errno;
+    char Wakeup = 'd';
+
+    (void)Signal;
+
+    if (write(WakeupPipe[1], &Wakeup, 1) < 0)
+    {
+        /* The pipe is full, a dump is pending anyway */
+    }
+
+    errno = SavedErrno;
+}
+
+static void* StatsThread(void* Context)
+{
+    char Buffer[2048];
+    char Command;
+    size_t Length;
+    int Listener = (int)(intptr_t)Context;
+    int Client;
+
+    for (;;)
+    {
+        struct pollfd fds[] = {
+            { WakeupPipe[0], POLLIN, 0 },
+            /* Negative without a stats socket, poll ignores it then */
+            { Listener, POLLIN, 0 },
+        };
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            if (read(WakeupPipe[0], &Command, 1) == 1 && Command == 'q')
+                break;
+
+            /* One write, so it doesn't get mixed with other output */
+            Length = FormatStats(Buffer, sizeof(Buffer));
+            WriteAll(STDERR_FILENO, Buffer, Length);
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            Client = accept4(Listener, NULL, NULL, SOCK_CLOEXEC);
+            if (Client < 0)
+                continue;
+
+            /* A client gets the snapshot and the connection is closed */
+            Length = FormatStats(Buffer, sizeof(Buffer));
+            WriteAll(Client, Buffer, Length);
+            close(Client);
+        }
+    }
+
+    if (Listener >= 0)
+        close(Listener);
+    close(WakeupPipe[0]);
+
+    return NULL;
+}
+
+bool StartStats(int Instance)
+{
+    struct sigaction Action;
+    pthread_t Thread;
+    int Listener = -1;
+
+    if (StatsStarted)
+        return true;
+
+    memset(Stats, 0, sizeof(Stats));
+
+    if (pipe2(WakeupPipe, O_CLOEXEC | O_NONBLOCK) < 0)
+    {
+        SysregPrintf("Cannot create the stats pipe: %d\n", errno);
+        return false;
+    }
+
+    /* Concurrent instances each get a socket of their own */
+    StatsSocket[0] = 0;
+    if (AppSettings.StatsSocket[0])
+    {
+        if (Instance > 0)
+            snprintf(StatsSocket, sizeof(StatsSocket), "%.96s.%d", AppSettings.StatsSocket, Instance);
+        else
+            snprintf(StatsSocket, sizeof(StatsSocket), "%s", AppSettings.StatsSocket);
+
+        Listener = CreateLocalSocket(StatsSocket);
+        if (Listener < 0)
+        {
+            SysregPrintf("No stats on %s\n", StatsSocket);
+            StatsSocket[0] = 0;
+        }
+    }
+
+    if (pthread_create(&Thread, NULL, StatsThread, (void*)(intptr_t)Listener) != 0)
+    {
+        SysregPrintf("Cannot start the stats thread\n");
+        if (Listener >= 0)
+        {
+            close(Listener);
+            unlink(StatsSocket);
+        }
+        close(WakeupPipe[0]);
+        close(WakeupPipe[1]);
+        return false;
+    }
+
+    pthread_detach(Thread);
+
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = DumpSignal;
+    Action.sa_flags = SA_RESTART;
+    sigemptyset(&Action.sa_mask);
+    sigaction(SIGUSR1, &Action, NULL);
+
+    StatsStarted = true;
+    return true;
+}
+
+void StopStats(void)
+{
+    char Command = 'q';
+
+    if (!StatsStarted)
+        return;
+
+    signal(SIGUSR1, SIG_IGN);
+
+    /* The thread closes the listener on its way out */
+    if (write(WakeupPipe[1], &Command, 1) < 0)
+        SysregPrintf("Cannot stop the stats thread\n");
+    close(WakeupPipe[1]);
+
+    if (StatsSocket[0])
+        unlink(StatsSocket);
+
+    StatsStarted = false;
+}
+
+/* sysreg2 --stats <socket>, prints the snapshot of a running test */
+int QueryStats(const char* SocketPath)
+{
+    struct sockaddr_un addr;
+    char Buffer[2048];
+    ssize_t got;
+    int fd;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SocketPath, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        SysregPrintf("Cannot connect to %s\n", SocketPath);
+        close(fd);
+        return 1;
+    }
+
+    while ((got = read(fd, Buffer, sizeof(Buffer))) > 0)
+        fwrite(Buffer, 1, got, stdout);
+
+    close(fd);
+    return 0;
+}
@@ -33,6 +33,7 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 #define EXIT_CHECKPOINT_REACHED     0
 #define EXIT_CONTINUE               1
@@ -42,6 +43,56 @@
 #define TYPE_KVM                    0
 #define TYPE_VMWARE_PLAYER          1
 #define TYPE_VIRTUALBOX             2
+#define TYPE_SIMULATED              3
+
+/* Timed phases of a run */
+#define PHASE_DISK_INIT             0
+#define PHASE_HOOK                  1
+#define PHASE_XML_RENDER            2
+#define PHASE_DEFINE                3
+#define PHASE_CREATE                4
+#define PHASE_FIRST_BYTE            5
+#define PHASE_CHECKPOINT            6
+#define PHASE_KDBG                  7
+#define PHASE_SHUTDOWN              8
+#define PHASE_UNDEFINE              9
+#define PHASE_RESET                 10
+#define NUM_PHASES                  11
+
+#define COUNTER_BYTES               0
+#define COUNTER_LINES               1
+#define COUNTER_RETRIES             2
+#define COUNTER_CONTS               3
+#define COUNTER_DROPPED             4
+#define NUM_COUNTERS                5
+
+/* Live counters, see stats.c */
+#define STAT_STAGE                  0
+#define STAT_BYTES                  1
+#define STAT_READS                  2
+#define STAT_POLLS                  3
+#define STAT_WRITES                 4
+#define STAT_LINES                  5
+#define STAT_KDBG_HITS              6
+#define STAT_CONTS                  7
+#define STAT_CACHE_HITS             8
+#define STAT_DROPPED                9
+#define STAT_RESOLVES               10
+#define STAT_RESOLVE_NS             11
+#define STAT_RESOLVE_MAX_NS         12
+#define STAT_LAST_LINE              13
+#define STAT_GUEST_CPU              14
+#define NUM_STATS                   15
+
+/* Lifecycle events reported by the test machine, as a bitmask */
+#define MACHINE_EVENT_STOPPED       0x1
+#define MACHINE_EVENT_REBOOTED      0x2
+#define MACHINE_EVENT_CRASHED       0x4
+
+#define LIVENESS_UNKNOWN            0
+#define LIVENESS_IDLE               1
+#define LIVENESS_PROGRESSING        2
+#define LIVENESS_SPINNING           3
 
 #ifdef __cplusplus
 extern "C"
@@ -55,6 +106,7 @@ typedef struct _stage
     char BootDevice[8];
     char Checkpoint[80];
     char HookCommand[255];
+    bool HookBeforeLaunch;
 }
 stage;
 
@@ -66,22 +118,80 @@ typedef struct _Settings
     char Name[80];
     char HardDiskImage[255];
     int ImageSize;
+    char ImageFormat[16];
     stage Stage[NUM_STAGES];
     unsigned int MaxCacheHits;
     unsigned int MaxRetries;
+    bool WarmRetry;
     unsigned int MaxConts;
     unsigned int VMType;
+    int CommandTimeout;
+    char MetricsJson[255];
+    char MetricsPrometheus[255];
+    char SerialLog[255];
+    unsigned int SerialLogFrame;
+    char HistoryFile[255];
+    double TimeoutFactor;
+    int MinTimeout;
+    int MaxTimeout;
+    char BaselineFile[255];
+    char ResultsFile[255];
+    int FailureBudget;
+    char SerialType[16];
+    char SerialAddress[255];
+    int SerialTimeout;
+    bool Placement;
+    char DiskCache[16];
+    char DiskIo[16];
+    char DiskBus[16];
+    char ImageDir[255];
+    bool Hugepages;
+    unsigned int Vcpus;
+    char RemoveDevices[255];
+    char ShardList[255];
+    char ShardImage[255];
+    unsigned int FloodBytes;
+    unsigned int FloodRate;
+    unsigned int FloodTail;
+    unsigned int FloodAbort;
+    char StatsSocket[100];
+    int LivenessInterval;
+    int SpinTimeout;
+    unsigned int BusyShare;
+    unsigned int BacktraceFrames;
+    char ResourcesFile[255];
+    int ResourcesInterval;
     union
     {
         struct
         {
             char Path[255];
-            int Socket;
         } VMwarePlayer;
+        struct
+        {
+            char Script[255];
+        } Simulated;
+        struct
+        {
+            char SerialSocket[255];
+        } KVM;
     } Specific;
 }
 Settings;
 
+typedef struct _Process
+{
+    pid_t Pid;
+    int OutFd;
+    const char* Name;
+    struct timespec Start;
+    char Line[256];
+    size_t LineLength;
+    int ExitCode;
+    bool Done;
+}
+Process;
+
 typedef struct _ModuleListEntry
 {
     struct _ModuleListEntry* Next;
@@ -90,30 +200,178 @@ typedef struct _ModuleListEntry
 }
 ModuleListEntry;
 
+/* What a guest used of the host, see resources.c */
+typedef struct _ResourceSample
+{
+    unsigned long long CpuTime;
+    unsigned long long Rss;
+    unsigned long long Balloon;
+    unsigned long long ReadBytes;
+    unsigned long long WriteBytes;
+    unsigned long long ReadOps;
+    unsigned long long WriteOps;
+}
+ResourceSample;
+
 /* utils.c */
 char* ReadFile (const char* filename);
 ssize_t safewriteex(int fd, const void *buf, size_t count, int timeout);
 #define safewrite(fd, buf, timeout) safewriteex(fd, buf, sizeof(buf) / sizeof(buf[0]) - 1, timeout)
 void SysregPrintf(const char* format, ...);
+int CreateLocalSocket(const char* Path);
+int AcceptLocalSocket(int Socket, int Timeout);
+
+/* process.c */
+bool StartProcess(Process* Proc, const char* const argv[]);
+bool StartCommand(Process* Proc, const char * command);
+bool PumpProcess(Process* Proc);
+void WatchProcess(Process* Proc);
+int WaitProcess(Process* Proc, int timeout);
+int ExecuteArgv(const char* const argv[], int timeout);
 int Execute(const char * command);
-bool CreateLocalSocket(void);
+
+/* metrics.c */
+unsigned long long MetricsNow(void);
+void MetricsSetStage(int Stage);
+void MetricsBegin(int Phase);
+bool MetricsPending(int Phase);
+unsigned long long MetricsElapsed(void);
+const char* MetricsPhaseName(int Phase);
+void MetricsEnd(int Phase);
+void MetricsCount(int Counter, unsigned long long Value);
+bool WriteMetrics(int Result);
 
 /* options.c */
+bool ReadSettings(const char* XmlConfig);
 bool LoadSettings(const char* XmlConfig);
 
+/* domain.c */
+bool LoadDomainTemplate(const char* XmlFileName);
+void FreeDomainTemplate(void);
+xmlDocPtr GetDomainTemplate(void);
+void DomainTemplateChanged(void);
+const char* GetDomainDiskImage(void);
+bool DomainRestartsOnReboot(void);
+void SetDomainDiskImage(const char* Path);
+void SetDomainName(const char* Name);
+bool SetDomainFloppyImage(const char* Path);
+void SetDomainCopy(unsigned int Copy);
+void SetDomainCdromImage(const char* Path);
+bool SetDomainSerialSocket(const char* Path);
+void SetDomainDiskFormat(const char* Format);
+bool SetDomainDiskTuning(const char* Cache, const char* Io, const char* Bus);
+unsigned int GetDomainVcpus(void);
+void SetDomainVcpus(unsigned int Vcpus);
+unsigned int RemoveDomainDevices(const char* Name, const char* Type);
+bool SetDomainHugepages(void);
+bool SetDomainPlacement(const unsigned int* VcpuPins, unsigned int Vcpus, unsigned int EmulatorCpu, int Node);
+const char* RenderDomainXml(const char* BootDevice);
+
 /* console.c */
-int ProcessDebugData(const char* tty, int timeout, int stage);
+int ProcessDebugData(int ttyfd, int timeout, int stage);
 
 /* raddr2line.c */
 void InitializeModuleList();
 void CleanModuleList();
 bool ResolveAddressFromFile(char* Buffer, size_t BufferSize, const char* Data);
 
+/* daemon.c */
+pid_t SpawnTest(const char* Defaults, const char* XmlConfig, const char* IsoImage, int OutFd, int Instance);
+int RunDaemon(const char* SocketPath, int Slots);
+int SubmitJob(const char* SocketPath, const char* XmlConfig, const char* IsoImage);
+
+/* seriallog.c */
+bool OpenSerialLog(void);
+void SerialLogLine(int Stage, const char* Line, bool Kdbg);
+void CloseSerialLog(void);
+bool ExtractSerialLog(const char* Log, const char* Selector);
+
+/* flood.c */
+bool FloodBegin(int Stage);
+bool FloodLine(const char* Line, bool Kdbg);
+bool FloodExceeded(void);
+void FloodEnd(void);
+
+/* stats.c */
+void StatsAdd(int Stat, unsigned long long Value);
+void StatsSet(int Stat, unsigned long long Value);
+void StatsMax(int Stat, unsigned long long Value);
+unsigned long long StatsGet(int Stat);
+bool StartStats(int Instance);
+void StopStats(void);
+int QueryStats(const char* SocketPath);
+
+/* liveness.c */
+void LivenessBegin(void);
+bool LivenessActive(void);
+void LivenessReset(void);
+int LivenessSample(void);
+unsigned int LivenessSpinning(void);
+const char* LivenessName(int Liveness);
+
+/* backtrace.c */
+void BacktraceModuleLine(const char* Line);
+bool HostBacktrace(int Stage);
+
+/* resources.c */
+bool OpenResources(void);
+bool ResourcesActive(void);
+void RecordResources(const ResourceSample* Sample);
+void ResourcesPhase(int Phase, bool End);
+void CloseResources(void);
+
+/* history.c */
+bool LoadHistory(void);
+bool SaveHistory(void);
+void FreeHistory(void);
+void HistoryRecord(const char* Test, unsigned int Duration, unsigned int Gap);
+int HistoryTimeout(const char* Test, int Default);
+unsigned int HistoryDuration(const char* Name);
+
+/* autotest.c */
+bool GetTestName(const char* Line, char* Name, size_t Size);
+bool GetTestResult(const char* Line, unsigned int* Executed, unsigned int* Failures);
+
+/* baseline.c */
+bool LoadBaseline(void);
+bool BaselineResult(const char* Test, unsigned int Executed, unsigned int Failures);
+bool SaveResults(void);
+void FreeBaseline(void);
+
+/* diskimage.c */
+bool CreateDiskImage(const char* Path, const char* Format, unsigned long long Size);
+bool CreateFloppyImage(const char* Path, const char* FileName, const char* Data, size_t Length);
+
+/* shard.c */
+extern int ShardIndex;
+extern char ShardListFile[255];
+extern char ShardResultsFile[255];
+bool SplitShards(const char* TestList, const char* History, unsigned int Shards, const char* Prefix);
+void IsolateInstance(int Instance);
+bool ApplyShard(void);
+bool MergeShards(const char* Prefix, unsigned int Shards, char* Summary, size_t Size);
+
+/* tuning.c */
+bool ApplyTuning(void);
+
+/* placement.c */
+bool ApplyPlacement(int Instance);
+
+/* manifest.c */
+int RunManifest(const char* Manifest);
+
 /* virt.c */
 extern const char* OutputPath;
+extern int InstanceIndex;
 extern Settings AppSettings;
 extern ModuleListEntry* ModuleList;
 bool BreakToDebugger(void);
+int GetMachineEventFd(void);
+int ReadMachineEvents(void);
+int GetConsoleWriteFd(void);
+bool GetMachineCpuTime(unsigned long long* CpuTime);
+bool MachineMonitorCommand(const char* Command, char* Result, size_t Size);
+int RunTest(const char* XmlConfig, const char* IsoImage);
 
 #ifdef __cplusplus
 }
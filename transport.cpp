@@ -0,0 +1,418 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Serial transports between the machine and the console
+ */
+
+#include "transport.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define RETRY_INTERVAL      100
+
+static long long Deadline(int Timeout)
+{
+    return (long long)(MetricsNow() / 1000000) + Timeout;
+}
+
+static int Remaining(long long End)
+{
+    long long Left = End - (long long)(MetricsNow() / 1000000);
+
+    return (Left > 0 ? (int)Left : 0);
+}
+
+/* The machine may not be listening yet, keep trying until the deadline */
+static int ConnectSocket(const struct sockaddr* Addr, socklen_t Length, int Timeout)
+{
+    long long End = Deadline(Timeout);
+    int fd, Error;
+    socklen_t ErrorLength;
+
+    do
+    {
+        fd = socket(Addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+
+        if (connect(fd, Addr, Length) == 0)
+            return fd;
+
+        if (errno == EINPROGRESS)
+        {
+            struct pollfd fds[] = {
+                { fd, POLLOUT, 0 },
+            };
+
+            if (poll(fds, 1, Remaining(End)) > 0)
+            {
+                ErrorLength = sizeof(Error);
+                if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &Error, &ErrorLength) == 0 && Error == 0)
+                    return fd;
+            }
+        }
+
+        close(fd);
+        usleep(RETRY_INTERVAL * 1000);
+    }
+    while (Remaining(End) > 0);
+
+    SysregPrintf("Couldn't connect to the machine serial port within %d ms\n", Timeout);
+    return -1;
+}
+
+SerialTransport::SerialTransport()
+{
+    Fd = -1;
+}
+
+SerialTransport::~SerialTransport()
+{
+    Close();
+}
+
+bool SerialTransport::Prepare()
+{
+    // Nothing to set up
+    return true;
+}
+
+int SerialTransport::GetWriteFd() const
+{
+    return Fd;
+}
+
+void SerialTransport::Close()
+{
+    if (Fd >= 0)
+    {
+        close(Fd);
+        Fd = -1;
+    }
+}
+
+PtyTransport::PtyTransport(const char* Path)
+{
+    strncpy(this->Path, Path, sizeof(this->Path) - 1);
+    this->Path[sizeof(this->Path) - 1] = 0;
+}
+
+int PtyTransport::Open(int Timeout)
+{
+    struct termios ttyattr;
+
+    /* The pty exists as soon as the machine does */
+    (void)Timeout;
+
+    /* fd is the file descriptor of the virtual COM port */
+    if ((Fd = open(Path, O_NOCTTY | O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0)
+    {
+        SysregPrintf("error opening tty\n");
+        return -1;
+    }
+
+    /* Don't let the line discipline mangle or buffer the data */
+    if (tcgetattr(Fd, &ttyattr) == 0)
+    {
+        cfmakeraw(&ttyattr);
+        tcsetattr(Fd, TCSANOW, &ttyattr);
+    }
+
+    return Fd;
+}
+
+UnixTransport::UnixTransport(const char* Path, bool Listen)
+{
+    strncpy(this->Path, Path, sizeof(this->Path) - 1);
+    this->Path[sizeof(this->Path) - 1] = 0;
+    this->Listen = Listen;
+    Listener = -1;
+}
+
+UnixTransport::~UnixTransport()
+{
+    if (Listener >= 0)
+    {
+        close(Listener);
+        unlink(Path);
+    }
+}
+
+bool UnixTransport::Prepare()
+{
+    if (!Listen || Listener >= 0)
+        return true;
+
+    Listener = CreateLocalSocket(Path);
+    return (Listener >= 0);
+}
+
+int UnixTransport::Open(int Timeout)
+{
+    struct sockaddr_un addr;
+
+    if (Listen)
+    {
+        Fd = AcceptLocalSocket(Listener, Timeout);
+        return Fd;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, Path, sizeof(addr.sun_path) - 1);
+
+    Fd = ConnectSocket((struct sockaddr*)&addr, sizeof(addr), Timeout);
+    return Fd;
+}
+
+TcpTransport::TcpTransport(const char* Address, bool Listen)
+{
+    strncpy(this->Address, Address, sizeof(this->Address) - 1);
+    this->Address[sizeof(this->Address) - 1] = 0;
+    this->Listen = Listen;
+    Listener = -1;
+}
+
+TcpTransport::~TcpTransport()
+{
+    if (Listener >= 0)
+        close(Listener);
+}
+
+/* "host:port", the host defaults to the loopback */
+bool TcpTransport::Resolve(struct sockaddr_storage* Addr, socklen_t* Length) const
+{
+    struct addrinfo Hints, *Result;
+    char Host[255];
+    const char* Port = strrchr(Address, ':');
+
+    if (!Port)
+    {
+        SysregPrintf("Invalid serial address %s, host:port expected\n", Address);
+        return false;
+    }
+
+    snprintf(Host, sizeof(Host), "%.*s", (int)(Port - Address), Address);
+
+    memset(&Hints, 0, sizeof(Hints));
+    Hints.ai_family = AF_UNSPEC;
+    Hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo((Host[0] ? Host : "127.0.0.1"), Port + 1, &Hints, &Result) != 0)
+    {
+        SysregPrintf("Cannot resolve %s\n", Address);
+        return false;
+    }
+
+    memcpy(Addr, Result->ai_addr, Result->ai_addrlen);
+    *Length = Result->ai_addrlen;
+    freeaddrinfo(Result);
+    return true;
+}
+
+bool TcpTransport::Prepare()
+{
+    struct sockaddr_storage Addr;
+    socklen_t Length;
+    int On = 1;
+
+    if (!Listen || Listener >= 0)
+        return true;
+
+    if (!Resolve(&Addr, &Length))
+        return false;
+
+    Listener = socket(Addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (Listener < 0)
+    {
+        SysregPrintf("Failed creating socket\n");
+        return false;
+    }
+
+    setsockopt(Listener, SOL_SOCKET, SO_REUSEADDR, &On, sizeof(On));
+
+    if (bind(Listener, (struct sockaddr*)&Addr, Length) < 0 || listen(Listener, 5) < 0)
+    {
+        SysregPrintf("Failed listening on %s\n", Address);
+        close(Listener);
+        Listener = -1;
+        return false;
+    }
+
+    return true;
+}
+
+int TcpTransport::Open(int Timeout)
+{
+    struct sockaddr_storage Addr;
+    socklen_t Length;
+    int On = 1;
+
+    if (Listen)
+    {
+        Fd = AcceptLocalSocket(Listener, Timeout);
+    }
+    else
+    {
+        if (!Resolve(&Addr, &Length))
+            return -1;
+
+        Fd = ConnectSocket((struct sockaddr*)&Addr, Length, Timeout);
+    }
+
+    /* KDBG commands are a few bytes, don't hold them back */
+    if (Fd >= 0)
+        setsockopt(Fd, IPPROTO_TCP, TCP_NODELAY, &On, sizeof(On));
+
+    return Fd;
+}
+
+FifoTransport::FifoTransport(const char* Path)
+{
+    strncpy(this->Path, Path, sizeof(this->Path) - 1);
+    this->Path[sizeof(this->Path) - 1] = 0;
+    WriteFd = -1;
+}
+
+FifoTransport::~FifoTransport()
+{
+    Close();
+}
+
+bool FifoTransport::Prepare()
+{
+    char Name[sizeof(Path) + 4];
+
+    snprintf(Name, sizeof(Name), "%s.in", Path);
+    if (mkfifo(Name, 0600) < 0 && errno != EEXIST)
+    {
+        SysregPrintf("Failed creating %s\n", Name);
+        return false;
+    }
+
+    snprintf(Name, sizeof(Name), "%s.out", Path);
+    if (mkfifo(Name, 0600) < 0 && errno != EEXIST)
+    {
+        SysregPrintf("Failed creating %s\n", Name);
+        return false;
+    }
+
+    return true;
+}
+
+int FifoTransport::Open(int Timeout)
+{
+    char Name[sizeof(Path) + 4];
+    long long End = Deadline(Timeout);
+
+    /* Opening for writing only works once the machine has the other end */
+    snprintf(Name, sizeof(Name), "%s.in", Path);
+    while ((WriteFd = open(Name, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+    {
+        if (errno != ENXIO || Remaining(End) == 0)
+        {
+            SysregPrintf("The machine didn't open %s within %d ms\n", Name, Timeout);
+            return -1;
+        }
+
+        usleep(RETRY_INTERVAL * 1000);
+    }
+
+    snprintf(Name, sizeof(Name), "%s.out", Path);
+    if ((Fd = open(Name, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+    {
+        SysregPrintf("Failed opening %s\n", Name);
+        Close();
+        return -1;
+    }
+
+    return Fd;
+}
+
+int FifoTransport::GetWriteFd() const
+{
+    return WriteFd;
+}
+
+void FifoTransport::Close()
+{
+    SerialTransport::Close();
+
+    if (WriteFd >= 0)
+    {
+        close(WriteFd);
+        WriteFd = -1;
+    }
+}
+
+ReplayTransport::ReplayTransport(const char* Path)
+{
+    strncpy(this->Path, Path, sizeof(this->Path) - 1);
+    this->Path[sizeof(this->Path) - 1] = 0;
+    NullFd = -1;
+}
+
+ReplayTransport::~ReplayTransport()
+{
+    Close();
+}
+
+int ReplayTransport::Open(int Timeout)
+{
+    (void)Timeout;
+
+    /* The end of the file looks like the machine hanging up */
+    Fd = open(Path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    NullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (Fd < 0 || NullFd < 0)
+    {
+        SysregPrintf("Failed opening %s\n", Path);
+        Close();
+        return -1;
+    }
+
+    return Fd;
+}
+
+int ReplayTransport::GetWriteFd() const
+{
+    return NullFd;
+}
+
+void ReplayTransport::Close()
+{
+    SerialTransport::Close();
+
+    if (NullFd >= 0)
+    {
+        close(NullFd);
+        NullFd = -1;
+    }
+}
+
+SerialTransport* CreateSerialTransport(const char* DefaultType, const char* DefaultAddress)
+{
+    const char* Type = (AppSettings.SerialType[0] ? AppSettings.SerialType : DefaultType);
+    const char* Address = (AppSettings.SerialAddress[0] ? AppSettings.SerialAddress : DefaultAddress);
+
+    if (!Type || !Address)
+        return NULL;
+
+    if (!strcmp(Type, "pty"))
+        return new PtyTransport(Address);
+    else if (!strcmp(Type, "unix"))
+        return new UnixTransport(Address, true);
+    else if (!strcmp(Type, "unix-connect"))
+        return new UnixTransport(Address, false);
+    else if (!strcmp(Type, "tcp"))
+        return new TcpTransport(Address, true);
+    else if (!strcmp(Type, "tcp-connect"))
+        return new TcpTransport(Address, false);
+    else if (!strcmp(Type, "fifo"))
+        return new FifoTransport(Address);
+    else if (!strcmp(Type, "replay"))
+        return new ReplayTransport(Address);
+
+    SysregPrintf("Unknown serial transport %s\n", Type);
+    return NULL;
+}
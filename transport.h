@@ -0,0 +1,112 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Serial transports between the machine and the console
+ */
+
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include "sysreg.h"
+
+/* A transport is prepared before the machine starts, then opened once the
+ * machine runs. Open() gives up after Timeout ms and returns a non-blocking
+ * fd that ProcessDebugData polls and reads from, writes go to GetWriteFd().
+ */
+class SerialTransport
+{
+public:
+    SerialTransport();
+    virtual ~SerialTransport();
+
+    virtual bool Prepare();
+    virtual int Open(int Timeout) = 0;
+    virtual int GetWriteFd() const;
+    virtual void Close();
+
+protected:
+    int Fd;
+};
+
+class PtyTransport : public SerialTransport
+{
+public:
+    PtyTransport(const char* Path);
+
+    virtual int Open(int Timeout);
+
+private:
+    char Path[255];
+};
+
+/* Unix socket: listening for the machine to connect, or connecting to it */
+class UnixTransport : public SerialTransport
+{
+public:
+    UnixTransport(const char* Path, bool Listen);
+    virtual ~UnixTransport();
+
+    virtual bool Prepare();
+    virtual int Open(int Timeout);
+
+private:
+    char Path[108];
+    bool Listen;
+    int Listener;
+};
+
+/* TCP on the loopback, "host:port", listening or connecting too */
+class TcpTransport : public SerialTransport
+{
+public:
+    TcpTransport(const char* Address, bool Listen);
+    virtual ~TcpTransport();
+
+    virtual bool Prepare();
+    virtual int Open(int Timeout);
+
+private:
+    bool Resolve(struct sockaddr_storage* Addr, socklen_t* Length) const;
+
+    char Address[255];
+    bool Listen;
+    int Listener;
+};
+
+/* A pair of FIFOs, <path>.out from the machine, <path>.in to it */
+class FifoTransport : public SerialTransport
+{
+public:
+    FifoTransport(const char* Path);
+    virtual ~FifoTransport();
+
+    virtual bool Prepare();
+    virtual int Open(int Timeout);
+    virtual int GetWriteFd() const;
+    virtual void Close();
+
+private:
+    char Path[250];
+    int WriteFd;
+};
+
+/* Plays back a recorded serial log, commands sent to it are dropped */
+class ReplayTransport : public SerialTransport
+{
+public:
+    ReplayTransport(const char* Path);
+    virtual ~ReplayTransport();
+
+    virtual int Open(int Timeout);
+    virtual int GetWriteFd() const;
+    virtual void Close();
+
+private:
+    char Path[255];
+    int NullFd;
+};
+
+/* The transport from the settings if any, else the one the machine asks for */
+SerialTransport* CreateSerialTransport(const char* DefaultType, const char* DefaultAddress);
+
+#endif
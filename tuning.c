@@ -0,0 +1,98 @@
+/*
+ * PROJECT:     ReactOS System Regression Testing Utility
+ * LICENSE:     GNU GPLv2 or any later version as published by the Free Software Foundation
+ * PURPOSE:     Applying the <tuning> section of the settings to the domain template
+ */
+
+#include "sysreg.h"
+#include <sys/vfs.h>
+
+/* The template is patched once, every launch renders it with the tuning,
+ * so the domain definition of a host doesn't need to be forked for it.
+ */
+
+#define TMPFS_MAGIC         0x01021994
+
+/* Move the hard disk image to Dir, keeping its name */
+static bool MoveDiskImage(const char* Dir)
+{
+    struct statfs Fs;
+    const char* Name = strrchr(AppSettings.HardDiskImage, '/');
+    char Path[sizeof(AppSettings.HardDiskImage)];
+
+    if (!AppSettings.HardDiskImage[0])
+        return true;
+
+    Name = (Name ? Name + 1 : AppSettings.HardDiskImage);
+    if (snprintf(Path, sizeof(Path), "%s/%s", Dir, Name) >= (int)sizeof(Path))
+    {
+        SysregPrintf("Tuning: %s/%s is too long\n", Dir, Name);
+        return false;
+    }
+
+    if (statfs(Dir, &Fs) < 0)
+    {
+        SysregPrintf("Tuning: cannot use %s for the disk image: %d\n", Dir, errno);
+        return false;
+    }
+
+    /* Any other file system still works, it just doesn't buy much */
+    if (Fs.f_type != TMPFS_MAGIC)
+        SysregPrintf("Tuning: %s is no tmpfs\n", Dir);
+
+    strcpy(AppSettings.HardDiskImage, Path);
+    SetDomainDiskImage(Path);
+    return true;
+}
+
+/* "graphics input:tablet" removes all graphics and the tablet input */
+static void RemoveDevices(const char* List)
+{
+    char Devices[sizeof(AppSettings.RemoveDevices)];
+    char* Device;
+    char* Type;
+    char* Next = NULL;
+    unsigned int Removed;
+
+    strcpy(Devices, List);
+
+    for (Device = strtok_r(Devices, " ,", &Next); Device; Device = strtok_r(NULL, " ,", &Next))
+    {
+        Type = strchr(Device, ':');
+        if (Type)
+            *Type++ = 0;
+
+        Removed = RemoveDomainDevices(Device, Type);
+        if (!Removed)
+            SysregPrintf("Tuning: no %s%s%s in the domain\n", Device, (Type ? " of type " : ""), (Type ? Type : ""));
+    }
+}
+
+bool ApplyTuning(void)
+{
+    /* Only the libvirt machines have a domain to tune */
+    if (AppSettings.VMType == TYPE_SIMULATED)
+        return true;
+
+    if (AppSettings.ImageDir[0] && !MoveDiskImage(AppSettings.ImageDir))
+        return false;
+
+    if ((AppSettings.DiskCache[0] || AppSettings.DiskIo[0] || AppSettings.DiskBus[0]) &&
+        !SetDomainDiskTuning((AppSettings.DiskCache[0] ? AppSettings.DiskCache : NULL),
+                             (AppSettings.DiskIo[0] ? AppSettings.DiskIo : NULL),
+                             (AppSettings.DiskBus[0] ? AppSettings.DiskBus : NULL)))
+    {
+        SysregPrintf("Tuning: the domain has no hard disk to tune\n");
+    }
+
+    if (AppSettings.Vcpus > 0)
+        SetDomainVcpus(AppSettings.Vcpus);
+
+    if (AppSettings.Hugepages)
+        SetDomainHugepages();
+
+    if (AppSettings.RemoveDevices[0])
+        RemoveDevices(AppSettings.RemoveDevices);
+
+    return true;
+}
@@ -30,6 +30,7 @@ ssize_t safewriteex(int fd, const void *buf, size_t count, int timeout)
         }
 
         ssize_t r = write(fd, buf, count);
+        StatsAdd(STAT_WRITES, 1);
 
         if (r < 0 && errno == EINTR)
             continue;
@@ -100,55 +101,72 @@ void SysregPrintf(const char* format, ...)
     va_end(args);
 }
 
-int Execute(const char * command)
+int CreateLocalSocket(const char* Path)
 {
-    FILE* in;
-    char out[255];
+    struct sockaddr_un addr;
+    int Socket;
 
-    in = popen(command, "r");
-    if (in == NULL)
+    if ((Socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
     {
-        SysregPrintf("popen() failed: %d\n", errno);
-        return -errno;
+        SysregPrintf("Failed creating socket\n");
+        return -1;
     }
 
-    while (feof(in) == 0)
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, Path, sizeof(addr.sun_path) - 1);
+
+    /* Safety measure */
+    unlink(Path);
+
+    if (bind(Socket, (struct sockaddr*)&addr, sizeof(addr)) < 0)
     {
-        if (fgets(out, 255, in) != NULL)
-            SysregPrintf("%s", out);
+        SysregPrintf("Failed binding\n");
+        close(Socket);
+        return -1;
+    }
+
+    if (listen(Socket, 5) < 0)
+    {
+        SysregPrintf("Failed listening\n");
+        close(Socket);
+        return -1;
     }
 
-    return pclose(in);
+    return Socket;
 }
 
-bool CreateLocalSocket(void)
+int AcceptLocalSocket(int Socket, int Timeout)
 {
-    struct sockaddr_un addr;
+    struct pollfd fds[] = {
+        { Socket, POLLIN, 0 },
+    };
+    int fd, got;
+
+    /* Wait for the machine to connect, but not forever */
+    do
+        got = poll(fds, 1, Timeout);
+    while (got < 0 && errno == EINTR);
 
-    if ((AppSettings.Specific.VMwarePlayer.Socket = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    if (got == 0)
     {
-        SysregPrintf("Failed creating socket\n");
-        return false;
+        SysregPrintf("The machine didn't connect to the serial port within %d ms\n", Timeout);
+        return -1;
     }
 
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, AppSettings.Specific.VMwarePlayer.Path, sizeof(addr.sun_path) - 1);
-
-    /* Safety measure */
-    unlink(AppSettings.Specific.VMwarePlayer.Path);
-
-    if (bind(AppSettings.Specific.VMwarePlayer.Socket, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    if (got < 0 || (fd = accept4(Socket, NULL, NULL, SOCK_CLOEXEC)) < 0)
     {
-        SysregPrintf("Failed binding\n");
-        return false;
+        SysregPrintf("error getting socket\n");
+        return -1;
     }
 
-    if (listen(AppSettings.Specific.VMwarePlayer.Socket, 5) < 0)
+    /* Set non blocking */
+    if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
     {
-        SysregPrintf("Failed listening\n");
-        return false;
+        SysregPrintf("error setting flag\n");
+        close(fd);
+        return -1;
     }
 
-    return true;
+    return fd;
 }
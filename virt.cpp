@@ -12,6 +12,7 @@
 
 const char DefaultOutputPath[] = "output-i386";
 const char* OutputPath;
+int InstanceIndex = 0;
 Settings AppSettings;
 ModuleListEntry* ModuleList;
 Machine * TestMachine = 0;
@@ -29,28 +30,127 @@ bool BreakToDebugger(void)
     return TestMachine->BreakToDebugger();
 }
 
-int main(int argc, char **argv)
+/* Wrappers for the lifecycle events of the machine */
+int GetMachineEventFd(void)
 {
-    int Ret = EXIT_DONT_CONTINUE;
-    char console[50];
-    unsigned int Retries;
-    unsigned int Stage;
+    if (TestMachine == 0)
+    {
+        return -1;
+    }
 
-    /* Get the output path to the built ReactOS files */
-    OutputPath = getenv("ROS_OUTPUT");
-    if(!OutputPath)
-        OutputPath = DefaultOutputPath;
+    return TestMachine->GetEventFd();
+}
 
-    InitializeModuleList();
+int ReadMachineEvents(void)
+{
+    if (TestMachine == 0)
+    {
+        return 0;
+    }
 
-    SysregPrintf("sysreg2 %s starting\n", gGitCommit);
+    return TestMachine->ReadEvents();
+}
+
+int GetConsoleWriteFd(void)
+{
+    if (TestMachine == 0)
+    {
+        return -1;
+    }
+
+    return TestMachine->GetConsoleWriteFd();
+}
+
+/* CPU time the guest used so far, in ns */
+bool GetMachineCpuTime(unsigned long long* CpuTime)
+{
+    if (TestMachine == 0)
+    {
+        return false;
+    }
+
+    return TestMachine->GetCpuTime(CpuTime);
+}
 
-    if (!LoadSettings(argc > 1 ? argv[1] : "sysreg.xml"))
+/* A command for the monitor of the emulator, with its answer */
+bool MachineMonitorCommand(const char* Command, char* Result, size_t Size)
+{
+    if (TestMachine == 0)
+    {
+        return false;
+    }
+
+    return TestMachine->MonitorCommand(Command, Result, Size);
+}
+
+#define HOOK_NONE       0
+#define HOOK_STARTED    1
+#define HOOK_FAILED     2
+
+/* Start a hook that runs concurrently with the stage setup */
+static int StartHook(unsigned int Stage, Process* Hook)
+{
+    if (AppSettings.Stage[Stage].HookCommand[0] == 0 || !AppSettings.Stage[Stage].HookBeforeLaunch)
+        return HOOK_NONE;
+
+    SysregPrintf("Starting hook: %s\n", AppSettings.Stage[Stage].HookCommand);
+    if (!StartCommand(Hook, AppSettings.Stage[Stage].HookCommand))
+        return HOOK_FAILED;
+
+    WatchProcess(Hook);
+    return HOOK_STARTED;
+}
+
+int RunTest(const char* XmlConfig, const char* IsoImage)
+{
+    int Ret = EXIT_DONT_CONTINUE;
+    int ConsoleFd;
+    Process Hook;
+    int HookState;
+    bool DiskReady;
+    bool HookPending = false;
+    bool Warm = false;
+    unsigned int Retries;
+    unsigned int Stage;
+
+    if (!LoadSettings(XmlConfig))
     {
         SysregPrintf("Cannot load configuration file\n");
         goto cleanup;
     }
 
+    if (!ApplyTuning())
+        goto cleanup;
+
+    /* Concurrent instances must not share a domain, a disk or a serial port */
+    IsolateInstance(InstanceIndex);
+
+    if (!ApplyShard())
+        goto cleanup;
+
+    if (!OpenSerialLog())
+        goto cleanup;
+
+    if (!OpenResources())
+        goto cleanup;
+
+    StartStats(InstanceIndex);
+
+    if (!LoadHistory())
+        SysregPrintf("Cannot read test history %s, starting a new one\n", AppSettings.HistoryFile);
+
+    if (!LoadBaseline())
+        SysregPrintf("Cannot read the baseline %s, no comparison\n", AppSettings.BaselineFile);
+
+    /* Boot another ISO than the one from the domain definition */
+    if (IsoImage)
+        SetDomainCdromImage(IsoImage);
+
+    /* Before the machine and its threads exist, they inherit the affinity.
+       Only KVM domains take cputune and numatune */
+    if (AppSettings.VMType == TYPE_KVM)
+        ApplyPlacement(InstanceIndex);
+
     /* Allocate proper machine */
     switch (AppSettings.VMType)
     {
@@ -65,6 +165,10 @@ int main(int argc, char **argv)
         case TYPE_VIRTUALBOX:
             TestMachine = new VirtualBox();
             break;
+
+        case TYPE_SIMULATED:
+            TestMachine = new SimulatedMachine();
+            break;
     }
 
     /* Don't go any further if connection failed */
@@ -81,16 +185,48 @@ int main(int argc, char **argv)
         goto cleanup;
     }
 
+    /* The first hook may already run while the disk gets created */
+    HookState = StartHook(0, &Hook);
+    if (HookState == HOOK_FAILED)
+    {
+        SysregPrintf("Hook command failed!\n");
+        goto cleanup;
+    }
+    HookPending = (HookState == HOOK_STARTED);
+
     /* Initialize disk if needed */
-    TestMachine->InitializeDisk();
+    MetricsBegin(PHASE_DISK_INIT);
+    DiskReady = TestMachine->InitializeDisk();
+    MetricsEnd(PHASE_DISK_INIT);
+    if (!DiskReady)
+    {
+        SysregPrintf("InitializeDisk failed!\n");
+        goto cleanup;
+    }
 
     for(Stage = 0; Stage < NUM_STAGES; Stage++)
     {
+        MetricsSetStage(Stage);
+
+        /* Start hook command along with the stage setup */
+        if (Stage > 0)
+        {
+            HookState = StartHook(Stage, &Hook);
+            if (HookState == HOOK_FAILED)
+            {
+                SysregPrintf("Hook command failed!\n");
+                goto cleanup;
+            }
+            HookPending = (HookState == HOOK_STARTED);
+        }
+
         /* Execute hook command before stage if any */
-        if (AppSettings.Stage[Stage].HookCommand[0] != 0)
+        if (AppSettings.Stage[Stage].HookCommand[0] != 0 && !AppSettings.Stage[Stage].HookBeforeLaunch)
         {
             SysregPrintf("Applying hook: %s\n", AppSettings.Stage[Stage].HookCommand);
+            MetricsBegin(PHASE_HOOK);
             int out = Execute(AppSettings.Stage[Stage].HookCommand);
+            MetricsEnd(PHASE_HOOK);
             if (out < 0)
             {
                 SysregPrintf("Hook command failed!\n");
@@ -102,40 +238,82 @@ int main(int argc, char **argv)
         {
             struct timeval StartTime, EndTime, ElapsedTime;
 
-            if (!TestMachine->LaunchMachine(AppSettings.Filename,
-                                            AppSettings.Stage[Stage].BootDevice))
+            /* A warm retry goes on with the machine and the console of the last try */
+            if (!Warm && !TestMachine->DefineMachine(AppSettings.Stage[Stage].BootDevice))
             {
-                SysregPrintf("LaunchMachine failed!\n");
+                SysregPrintf("DefineMachine failed!\n");
+                goto cleanup;
+            }
+
+            /* The machine can't start before the hook is done */
+            if (HookPending)
+            {
+                struct timeval HookStart, HookEnd, HookWait;
+
+                gettimeofday(&HookStart, NULL);
+                MetricsBegin(PHASE_HOOK);
+                int out = WaitProcess(&Hook, AppSettings.CommandTimeout * 1000);
+                MetricsEnd(PHASE_HOOK);
+                HookPending = false;
+                gettimeofday(&HookEnd, NULL);
+
+                timersub(&HookEnd, &HookStart, &HookWait);
+                SysregPrintf("Waited %ld.%06ld seconds for hook\n", HookWait.tv_sec, HookWait.tv_usec);
+
+                if (out < 0)
+                {
+                    SysregPrintf("Hook command failed!\n");
+                    goto cleanup;
+                }
+            }
+
+            if (!Warm && !TestMachine->StartMachine())
+            {
+                SysregPrintf("StartMachine failed!\n");
                 goto cleanup;
             }
 
             printf("\n\n\n");
             SysregPrintf("Running stage %d...\n", Stage + 1);
-            SysregPrintf("Domain %s started.\n", TestMachine->GetMachineName());
+            SysregPrintf("Domain %s %s.\n", TestMachine->GetMachineName(), (Warm ? "reset" : "started"));
 
             gettimeofday(&StartTime, NULL);
 
-            if (!TestMachine->GetConsole(console))
+            if (!Warm)
+                ConsoleFd = TestMachine->OpenConsole();
+            if (ConsoleFd < 0)
             {
-                SysregPrintf("GetConsole failed!\n");
+                SysregPrintf("OpenConsole failed!\n");
                 goto cleanup;
             }
-            Ret = ProcessDebugData(console, AppSettings.Timeout, Stage);
+            Ret = ProcessDebugData(ConsoleFd, AppSettings.Timeout, Stage);
 
             gettimeofday(&EndTime, NULL);
 
-            TestMachine->ShutdownMachine();
+            /* Reset a machine that is still up for the next try, rather than going through
+               shutdown, undefine, define and create again */
+            Warm = (Ret == EXIT_CONTINUE && *AppSettings.Stage[Stage].Checkpoint && AppSettings.WarmRetry &&
+                    Retries + 1 < AppSettings.MaxRetries && TestMachine->ResetMachine());
+            if (!Warm)
+            {
+                TestMachine->CloseConsole();
+                TestMachine->ShutdownMachine();
+            }
 
             timersub(&EndTime, &StartTime, &ElapsedTime);
             SysregPrintf("Stage took: %ld.%06ld seconds\n", ElapsedTime.tv_sec, ElapsedTime.tv_usec);
 
-            usleep(1000);
+            if (!Warm)
+                usleep(1000);
 
             /* If we have a checkpoint to reach for success, assume that
                the application used for running the tests (probably "rosautotest")
                continues with the next test after a VM restart. */
             if (Ret == EXIT_CONTINUE && *AppSettings.Stage[Stage].Checkpoint)
-                SysregPrintf("Rebooting machine (retry %d)\n", Retries + 1);
+            {
+                SysregPrintf("Rebooting machine (retry %d%s)\n", Retries + 1, (Warm ? ", warm" : ""));
+                MetricsCount(COUNTER_RETRIES, 1);
+            }
             else
                 break;
         }
@@ -152,9 +330,18 @@ int main(int argc, char **argv)
 
 
 cleanup:
-    xmlCleanupParser();
-
-    CleanModuleList();
+    /* Don't leave a hook behind */
+    if (HookPending)
+        WaitProcess(&Hook, 1);
+
+    FreeDomainTemplate();
+    StopStats();
+    CloseSerialLog();
+    CloseResources();
+    SaveHistory();
+    FreeHistory();
+    SaveResults();
+    FreeBaseline();
 
     switch (Ret)
     {
@@ -171,7 +358,55 @@ cleanup:
             break;
     }
 
+    WriteMetrics(Ret);
+
     delete TestMachine;
+    TestMachine = 0;
+
+    return Ret;
+}
+
+int main(int argc, char **argv)
+{
+    int Ret;
+
+    /* Get the output path to the built ReactOS files */
+    OutputPath = getenv("ROS_OUTPUT");
+    if(!OutputPath)
+        OutputPath = DefaultOutputPath;
+
+    /* Separately started instances tell which one they are */
+    if (getenv("SYSREG_INSTANCE") && atoi(getenv("SYSREG_INSTANCE")) > 0)
+        InstanceIndex = atoi(getenv("SYSREG_INSTANCE"));
+
+    /* sysreg2 --submit <socket> <config> [iso] is only a client, don't bother with modules */
+    if (argc > 3 && !strcmp(argv[1], "--submit"))
+        return SubmitJob(argv[2], argv[3], (argc > 4 ? argv[4] : NULL));
+
+    /* sysreg2 --stats <socket> only asks a running test for its counters */
+    if (argc > 2 && !strcmp(argv[1], "--stats"))
+        return QueryStats(argv[2]);
+
+    /* sysreg2 --log-extract <log> <selector> only reads a serial log */
+    if (argc > 3 && !strcmp(argv[1], "--log-extract"))
+        return (ExtractSerialLog(argv[2], argv[3]) ? 0 : 1);
+
+    InitializeModuleList();
+
+    SysregPrintf("sysreg2 %s starting\n", gGitCommit);
+
+    /* sysreg2 --daemon <socket> [slots] keeps the module list for all the jobs it runs */
+    if (argc > 2 && !strcmp(argv[1], "--daemon"))
+        Ret = RunDaemon(argv[2], (argc > 3 ? atoi(argv[3]) : 1));
+    /* sysreg2 --manifest <manifest> runs all the configurations listed in it */
+    else if (argc > 2 && !strcmp(argv[1], "--manifest"))
+        Ret = RunManifest(argv[2]);
+    else
+        Ret = RunTest(argc > 1 ? argv[1] : "sysreg.xml", NULL);
+
+    xmlCleanupParser();
+
+    CleanModuleList();
 
     return Ret;
 }
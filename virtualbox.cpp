@@ -12,37 +12,30 @@ VirtualBox::VirtualBox()
     vConn = virConnectOpen("vbox:///session");
 }
 
-bool VirtualBox::GetConsole(char* console)
+int VirtualBox::OpenConsole()
 {
-    console[0] = 0;
-    return true;
+    return OpenTransport();
 }
 
-void VirtualBox::InitializeDisk()
+bool VirtualBox::InitializeDisk()
 {
-    char vboxmanage_cmdline[300];
+    const char* argv[] = { "VBoxManage", "closemedium", "disk", AppSettings.HardDiskImage, "--delete", NULL };
 
     /* Make sure the previous disk was removed from VBox to prevent UUID issues */
-    sprintf(vboxmanage_cmdline, "VBoxManage closemedium disk %s --delete", AppSettings.HardDiskImage);
-    Execute(vboxmanage_cmdline);
+    ExecuteArgv(argv, AppSettings.CommandTimeout * 1000);
 
     /* Call main creation */
-    LibVirt::InitializeDisk();
+    return LibVirt::InitializeDisk();
 }
 
 bool VirtualBox::PrepareSerialPort()
 {
-    char vboxmanage_cmdline[300];
+    const char* argv[] = { "VBoxManage", "setextradata", AppSettings.Name,
+                           "VBoxInternal/Devices/serial/0/Config/YieldOnLSRRead", "1", NULL };
 
     /* VirtualBox 5.x serial port output is unbearably slow by default, fix that! */
-    sprintf(vboxmanage_cmdline, "VBoxManage setextradata %s VBoxInternal/Devices/serial/0/Config/YieldOnLSRRead 1", AppSettings.Name);
-    Execute(vboxmanage_cmdline);
+    ExecuteArgv(argv, AppSettings.CommandTimeout * 1000);
 
-    return CreateLocalSocket();
-}
-
-void VirtualBox::CloseSerialPort()
-{
-    close(AppSettings.Specific.VMwarePlayer.Socket);
-    unlink(AppSettings.Specific.VMwarePlayer.Path);
+    /* The machine connects to our socket */
+    return PrepareTransport("unix", AppSettings.Specific.VMwarePlayer.Path);
 }
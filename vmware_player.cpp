@@ -12,20 +12,14 @@ VMWarePlayer::VMWarePlayer()
     vConn = virConnectOpen("vmwareplayer:///session");
 }
 
-bool VMWarePlayer::GetConsole(char* console)
+int VMWarePlayer::OpenConsole()
 {
-    console[0] = 0;
-    return true;
+    return OpenTransport();
 }
 
 bool VMWarePlayer::PrepareSerialPort()
 {
-    return CreateLocalSocket();
-}
-
-void VMWarePlayer::CloseSerialPort()
-{
-    close(AppSettings.Specific.VMwarePlayer.Socket);
-    unlink(AppSettings.Specific.VMwarePlayer.Path);
+    /* The machine connects to our socket */
+    return PrepareTransport("unix", AppSettings.Specific.VMwarePlayer.Path);
 }
 